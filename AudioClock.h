@@ -0,0 +1,74 @@
+#ifndef AUDIO_CLOCK_H__
+#define AUDIO_CLOCK_H__
+
+#include <Audio.h>
+
+// Sample accurate time base driven by the audio interrupt.
+//
+// AudioControlClock has no inputs or outputs, it only counts blocks. Declare
+// it before every other audio object: the library updates objects in the
+// order they were constructed, so listeners run at the start of each audio
+// cycle and anything they change is heard in the very same block.
+//
+// Listeners run inside the audio interrupt. Keep them short, integer only,
+// and guard any state they share with loop() using AudioNoInterrupts().
+
+const uint8_t AUDIO_CLOCK_LISTENERS = 8;
+
+typedef void (*AudioClockListener)(uint32_t blockStart);
+
+class AudioControlClock : public AudioStream {
+  public:
+    AudioControlClock() : AudioStream(0, NULL) {
+      active = true; // nothing is connected to us, run anyway
+    }
+    virtual void update(void);
+
+    bool addListener(AudioClockListener listener);
+
+    // Samples rendered so far, wraps after ~27 hours
+    uint32_t samples() { return _blocks * AUDIO_BLOCK_SAMPLES; }
+    uint32_t blocks() { return _blocks; }
+    uint32_t blockMicros() { return _blockMicros; }
+    uint32_t samplesNow();
+
+  private:
+    volatile uint32_t _blocks = 0;
+    volatile uint32_t _blockMicros = 0;
+    AudioClockListener _listeners[AUDIO_CLOCK_LISTENERS];
+    uint8_t _listenerCount = 0;
+};
+
+bool AudioControlClock::addListener(AudioClockListener listener) {
+  if (_listenerCount >= AUDIO_CLOCK_LISTENERS) return false;
+  AudioNoInterrupts();
+  _listeners[_listenerCount++] = listener;
+  AudioInterrupts();
+  return true;
+}
+
+// Sample position right now, interpolated from the start of the block being
+// rendered. For timestamping events that arrive in loop(), not for the ISR.
+uint32_t AudioControlClock::samplesNow() {
+  uint32_t blocks;
+  uint32_t elapsed;
+  do {
+    blocks = _blocks;
+    elapsed = micros() - _blockMicros;
+  } while (blocks != _blocks);
+
+  uint32_t offset = (elapsed * (uint32_t)(AUDIO_SAMPLE_RATE_EXACT / 100)) / 10000;
+  if (offset > AUDIO_BLOCK_SAMPLES) offset = AUDIO_BLOCK_SAMPLES;
+  return (blocks - 1) * AUDIO_BLOCK_SAMPLES + offset;
+}
+
+void AudioControlClock::update(void) {
+  uint32_t blockStart = _blocks * AUDIO_BLOCK_SAMPLES;
+  _blockMicros = micros();
+  for (uint8_t i = 0; i < _listenerCount; i++) {
+    _listeners[i](blockStart);
+  }
+  _blocks = _blocks + 1;
+}
+
+#endif
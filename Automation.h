@@ -0,0 +1,450 @@
+#ifndef AUTOMATION_H__
+#define AUTOMATION_H__
+
+#include <Arduino.h>
+
+// Automation lanes: CC movements recorded against the sequencer's clock and
+// played back in a loop.
+//
+// Time is counted in ticks of AUTOMATION_PPQN per quarter note, derived
+// from the sequencer's step length, so it follows CCtempo and an external
+// MIDI clock alike. With the clock, align() also pins the position to the
+// clocks received. A lane is one (part, CC) pair, taken the first time that
+// CC is recorded.
+//
+// Each lane is its own stream of tokens, kept in pages of a shared pool:
+//
+//   0ttttttt          wait t ticks (1..127)
+//   10wwwddd          after w more ticks (0..7) move by d (-4..3)
+//   110nnnnn          the last move again, n + 1 more times
+//   11100000 0vvvvvvv jump to v
+//
+// so a knob turned by hand costs about a byte per step, a steady sweep a
+// fraction of that and a knob left alone nothing; the pool holds minutes.
+//
+// Recording overdubs a lane at a time. The first move of a lane in a pass
+// copies its old stream up to that tick into a new one, and from then on
+// the new moves replace the old until the end of the loop, where the new
+// stream takes over. Lanes not touched keep their stream as it is.
+//
+// tick() runs in the audio interrupt. However many moves of a lane fall in
+// one block, the lane is applied once with its latest value. input() is
+// called from loop() and from the menu thread, and goes through a small
+// queue; a push is one step with interrupts off, so neither thread can cut
+// into the other's.
+
+typedef void (*AutomationApply)(byte part, byte control, byte value);
+
+const byte AUTOMATION_LANES = 8;
+const byte AUTOMATION_PAGES = 128;
+const byte AUTOMATION_PAGE_SIZE = 32;
+const uint16_t AUTOMATION_PPQN = 96;
+const byte AUTOMATION_QUEUE = 32;
+const byte AUTOMATION_NONE = 255;
+
+enum AutomationMode {
+  AUTOMATION_STOP = 0,
+  AUTOMATION_PLAY,
+  AUTOMATION_RECORD
+};
+
+class AutomationLanes {
+  public:
+    AutomationLanes() { reset(); }
+    void begin(AutomationApply apply) { _apply = apply; }
+
+    void mode(byte mode);
+    byte mode() { return _mode; }
+    void length(uint16_t quarters);
+    void clear() { _clear = true; }
+    void restart() { _restart = true; }
+    void align(uint32_t ticks) { _clockTick = ticks; _clockAligned = true; }
+    void unaligned() { _clockAligned = false; }
+
+    void input(byte part, byte control, byte value);
+    void tick(uint16_t blockSamples, uint32_t stepQ8, byte ticksPerStep);
+
+    uint16_t used() { return (AUTOMATION_PAGES - _freePages) * AUTOMATION_PAGE_SIZE; }
+    bool overflow() { return _overflow; }
+
+  private:
+    struct Stream {
+      byte head;
+      uint16_t length;
+    };
+
+    struct Reader {
+      byte page;
+      byte offset;
+      uint16_t left;
+      uint32_t tick;
+      byte value;
+      byte lastMove;
+      byte repeats;
+    };
+
+    struct Writer {
+      Stream stream;
+      byte page;
+      byte offset;
+      uint32_t tick;
+      int16_t value;    // -1 before the first move
+      byte lastMove;
+      uint8_t *run;     // the run token being counted up
+    };
+
+    struct Lane {
+      byte part;
+      byte control;
+      Stream play;
+      Reader reader;
+      Writer writer;
+      uint32_t nextAt;
+      byte nextValue;
+      bool pending;     // nextAt and nextValue hold the reader's next move
+      bool touched;     // recorded this pass
+    };
+
+    struct Event {
+      byte part;
+      byte control;
+      byte value;
+    };
+
+    void reset();
+    void freeStream(Stream &stream);
+    void startReader(Reader &reader, const Stream &stream);
+    bool readByte(Reader &reader, uint8_t &value);
+    bool next(Reader &reader, uint32_t &at, byte &value);
+    uint8_t *put(Writer &writer, uint8_t token);
+    void waits(Writer &writer, uint32_t gap);
+    void write(Writer &writer, uint32_t at, byte value);
+    byte lane(byte part, byte control);
+    void touch(Lane &lane);
+    void loopStart();
+    void advance();
+
+    AutomationApply _apply = NULL;
+    uint8_t _page[AUTOMATION_PAGES][AUTOMATION_PAGE_SIZE];
+    byte _nextPage[AUTOMATION_PAGES];
+    byte _free;
+    byte _freePages;
+
+    Lane _lane[AUTOMATION_LANES];
+    byte _lanes;
+    byte _value[AUTOMATION_LANES];
+    byte _dirty;           // lanes to apply at the end of the block
+
+    Event _queue[AUTOMATION_QUEUE];
+    volatile byte _queueHead = 0;
+    volatile byte _queueTail = 0;
+
+    volatile byte _mode = AUTOMATION_STOP;
+    volatile bool _restart = false;
+    volatile bool _clear = false;
+    volatile uint32_t _clockTick = 0;
+    volatile bool _clockAligned = false;
+    uint32_t _loopTicks = 16 * AUTOMATION_PPQN;
+    uint32_t _ticks = 0;   // since the top of the loop
+    uint32_t _fractionQ8 = 0;
+    bool _overflow;
+};
+
+void AutomationLanes::reset() {
+  for (byte p = 0; p < AUTOMATION_PAGES; p++) _nextPage[p] = p + 1 < AUTOMATION_PAGES ? p + 1 : AUTOMATION_NONE;
+  _free = 0;
+  _freePages = AUTOMATION_PAGES;
+  _lanes = 0;
+  _dirty = 0;
+  _overflow = false;
+}
+
+void AutomationLanes::freeStream(Stream &stream) {
+  byte page = stream.head;
+  while (page != AUTOMATION_NONE) {
+    byte next = _nextPage[page];
+    _nextPage[page] = _free;
+    _free = page;
+    _freePages++;
+    page = next;
+  }
+  stream.head = AUTOMATION_NONE;
+  stream.length = 0;
+}
+
+void AutomationLanes::startReader(Reader &reader, const Stream &stream) {
+  reader.page = stream.head;
+  reader.offset = 0;
+  reader.left = stream.length;
+  reader.tick = 0;
+  reader.value = 0;
+  reader.lastMove = 0;
+  reader.repeats = 0;
+}
+
+bool AutomationLanes::readByte(Reader &reader, uint8_t &value) {
+  if (!reader.left) return false;
+  if (reader.offset == AUTOMATION_PAGE_SIZE) {
+    reader.page = _nextPage[reader.page];
+    reader.offset = 0;
+  }
+  value = _page[reader.page][reader.offset++];
+  reader.left--;
+  return true;
+}
+
+bool AutomationLanes::next(Reader &reader, uint32_t &at, byte &value) {
+  uint8_t token;
+  while (reader.repeats || readByte(reader, token)) {
+    if (reader.repeats) {
+      reader.repeats--;
+      token = reader.lastMove;
+    }
+    if (!(token & 0x80)) {
+      reader.tick += token;
+      reader.lastMove = 0;
+      continue;
+    }
+    if ((token & 0xC0) == 0x80) {
+      reader.tick += (token >> 3) & 7;
+      reader.value += (int8_t)(token << 5) >> 5;
+      reader.lastMove = token;
+    } else if ((token & 0xE0) == 0xC0) {
+      if (reader.lastMove) reader.repeats = (token & 31) + 1;
+      continue;
+    } else {
+      uint8_t jump;
+      if (!readByte(reader, jump)) return false;
+      reader.value = jump & 0x7F;
+      reader.lastMove = 0;
+    }
+    at = reader.tick;
+    value = reader.value;
+    return true;
+  }
+  return false;
+}
+
+// One more byte on the end of the stream, NULL once the pool is used up
+uint8_t *AutomationLanes::put(Writer &writer, uint8_t token) {
+  if (writer.stream.head == AUTOMATION_NONE || writer.offset == AUTOMATION_PAGE_SIZE) {
+    if (_free == AUTOMATION_NONE) {
+      _overflow = true;
+      return NULL;
+    }
+    byte page = _free;
+    _free = _nextPage[page];
+    _freePages--;
+    _nextPage[page] = AUTOMATION_NONE;
+    if (writer.stream.head == AUTOMATION_NONE) writer.stream.head = page;
+    else _nextPage[writer.page] = page;
+    writer.page = page;
+    writer.offset = 0;
+  }
+  uint8_t *at = &_page[writer.page][writer.offset++];
+  *at = token;
+  writer.stream.length++;
+  return at;
+}
+
+void AutomationLanes::waits(Writer &writer, uint32_t gap) {
+  while (gap) {
+    byte wait = gap > 127 ? 127 : gap;
+    put(writer, wait);
+    gap -= wait;
+  }
+  writer.lastMove = 0;
+  writer.run = NULL;
+}
+
+void AutomationLanes::write(Writer &writer, uint32_t at, byte value) {
+  if (writer.value == value) return;
+  uint32_t gap = at - writer.tick;
+  // Room for the longest case first, so a full pool truncates the stream cleanly
+  uint32_t room = (uint32_t)_freePages * AUTOMATION_PAGE_SIZE;
+  if (writer.stream.head != AUTOMATION_NONE) room += AUTOMATION_PAGE_SIZE - writer.offset;
+  if (gap / 127 + 3 > room) {
+    _overflow = true;
+    return;
+  }
+  int16_t delta = writer.value < 0 ? 128 : value - writer.value;
+  writer.tick = at;
+  writer.value = value;
+
+  if (delta < -4 || delta > 3) {
+    waits(writer, gap);
+    put(writer, 0xE0);
+    put(writer, value);
+    return;
+  }
+  if (gap > 7) {
+    waits(writer, gap);
+    gap = 0;
+  }
+  uint8_t move = 0x80 | (gap << 3) | (delta & 7);
+  if (move == writer.lastMove) {
+    if (writer.run && (*writer.run & 31) < 31) {
+      (*writer.run)++;
+      return;
+    }
+    if (!writer.run) {
+      writer.run = put(writer, 0xC0);
+      if (writer.run) return;
+    }
+  }
+  put(writer, move);
+  writer.lastMove = move;
+  writer.run = NULL;
+}
+
+void AutomationLanes::mode(byte mode) {
+  if (mode > AUTOMATION_RECORD) return;
+  if (_mode == AUTOMATION_STOP && mode != AUTOMATION_STOP) _restart = true;
+  _mode = mode;
+}
+
+void AutomationLanes::length(uint16_t quarters) {
+  if (quarters < 1) quarters = 1;
+  __disable_irq();
+  _loopTicks = (uint32_t)quarters * AUTOMATION_PPQN;
+  __enable_irq();
+}
+
+// From loop() or the menu thread, ignored unless recording
+void AutomationLanes::input(byte part, byte control, byte value) {
+  if (_mode != AUTOMATION_RECORD) return;
+  __disable_irq();
+  byte next = (_queueHead + 1) % AUTOMATION_QUEUE;
+  if (next != _queueTail) {
+    _queue[_queueHead].part = part;
+    _queue[_queueHead].control = control;
+    _queue[_queueHead].value = value;
+    _queueHead = next;
+  }
+  __enable_irq();
+}
+
+byte AutomationLanes::lane(byte part, byte control) {
+  for (byte l = 0; l < _lanes; l++) {
+    if (_lane[l].part == part && _lane[l].control == control) return l;
+  }
+  if (_lanes == AUTOMATION_LANES) return AUTOMATION_NONE;
+  Lane &lane = _lane[_lanes];
+  lane.part = part;
+  lane.control = control;
+  lane.play.head = AUTOMATION_NONE;
+  lane.play.length = 0;
+  lane.pending = false;
+  lane.touched = false;
+  return _lanes++;
+}
+
+// First move of a lane this pass: a new stream, with the old one copied up to now
+void AutomationLanes::touch(Lane &lane) {
+  lane.touched = true;
+  lane.pending = false;
+  Writer &writer = lane.writer;
+  writer.stream.head = AUTOMATION_NONE;
+  writer.stream.length = 0;
+  writer.tick = 0;
+  writer.value = -1;
+  writer.lastMove = 0;
+  writer.run = NULL;
+
+  Reader old;
+  startReader(old, lane.play);
+  uint32_t at;
+  byte value;
+  while (next(old, at, value) && at <= _ticks) write(writer, at, value);
+}
+
+// Top of the loop, each overdubbed lane swaps to its new stream
+void AutomationLanes::loopStart() {
+  _ticks = 0;
+  for (byte l = 0; l < _lanes; l++) {
+    Lane &lane = _lane[l];
+    if (lane.touched) {
+      freeStream(lane.play);
+      lane.play = lane.writer.stream;
+      lane.touched = false;
+    }
+    startReader(lane.reader, lane.play);
+    lane.pending = next(lane.reader, lane.nextAt, lane.nextValue);
+  }
+}
+
+// One tick: the moves played back, then those played in
+void AutomationLanes::advance() {
+  for (byte l = 0; l < _lanes; l++) {
+    Lane &lane = _lane[l];
+    while (lane.pending && lane.nextAt <= _ticks) {
+      _value[l] = lane.nextValue;
+      _dirty |= 1 << l;
+      lane.pending = next(lane.reader, lane.nextAt, lane.nextValue);
+    }
+  }
+
+  while (_queueTail != _queueHead) {
+    Event &e = _queue[_queueTail];
+    byte l = lane(e.part, e.control);
+    if (l != AUTOMATION_NONE) {
+      Lane &lane = _lane[l];
+      if (!lane.touched) touch(lane);
+      write(lane.writer, _ticks, e.value);
+      _value[l] = e.value;
+      _dirty &= ~(1 << l);  // already heard, it came through the CC path
+    }
+    _queueTail = (_queueTail + 1) % AUTOMATION_QUEUE;
+  }
+
+  if (++_ticks >= _loopTicks) loopStart();
+}
+
+// Audio interrupt, once per block
+void AutomationLanes::tick(uint16_t blockSamples, uint32_t stepQ8, byte ticksPerStep) {
+  if (_clear) {
+    _clear = false;
+    reset();
+    _queueTail = _queueHead;
+    _restart = true;
+  }
+  if (_mode == AUTOMATION_STOP) {
+    _queueTail = _queueHead;
+    return;
+  }
+  if (_restart) {
+    _restart = false;
+    _fractionQ8 = 0;
+    for (byte l = 0; l < _lanes; l++) {
+      if (_lane[l].touched) freeStream(_lane[l].writer.stream);
+      _lane[l].touched = false;
+    }
+    loopStart();
+  }
+
+  uint32_t tickQ8 = stepQ8 / ticksPerStep;
+  if (tickQ8 < 256) tickQ8 = 256;
+  _fractionQ8 += (uint32_t)blockSamples << 8;
+  uint32_t due = _fractionQ8 / tickQ8;
+  _fractionQ8 -= due * tickQ8;
+  if (_clockAligned) {
+    // Never more than a clock ahead of the clocks received, catch up when behind
+    int32_t ahead = (int32_t)(_ticks + due) - (int32_t)(_clockTick % _loopTicks);
+    if (ahead < -(int32_t)_loopTicks / 2) ahead += _loopTicks;
+    if (ahead > (int32_t)_loopTicks / 2) ahead -= _loopTicks;
+    int32_t limit = AUTOMATION_PPQN / 24;
+    if (ahead > limit) due = due > (uint32_t)(ahead - limit) ? due - (ahead - limit) : 0;
+    else if (ahead < 0) due += -ahead;
+  }
+  while (due--) advance();
+
+  byte dirty = _dirty;
+  _dirty = 0;
+  for (byte l = 0; l < _lanes && dirty; l++) {
+    if (!(dirty & (1 << l))) continue;
+    dirty &= ~(1 << l);
+    if (_apply) _apply(_lane[l].part, _lane[l].control, _value[l]);
+  }
+}
+
+#endif
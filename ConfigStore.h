@@ -0,0 +1,176 @@
+#ifndef CONFIG_STORE_H__
+#define CONFIG_STORE_H__
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+// Settings kept in RAM and written to EEPROM later, a little at a time.
+//
+// set() only changes RAM. poll() writes at most one 8 byte record per call,
+// and only once the settings have been left alone for CONFIG_COMMIT_DELAY,
+// so a burst of edits costs one write per key, not one per edit.
+//
+// The EEPROM area is a ring of records (sequence, key, value, CRC-8) that
+// is only ever appended to, so every cell is written once per lap instead
+// of the same few cells on every save. The newest record of a key is its
+// value. When the record just past the head is still some key's newest,
+// that key is written again at the head first, so a live record is never
+// overwritten, not even by a write cut short. This is the compaction, and
+// it also keeps every valid record within about one lap of the head, so
+// the 16 bit sequence numbers always compare correctly.
+//
+// begin() reads the ring once: each key takes its newest record with a
+// good CRC and the head goes after the newest record of all. A write cut
+// short by power loss fails its CRC and the key's previous record stands.
+
+const byte CONFIG_KEYS = 32;
+const uint16_t CONFIG_LOG_START = 64;       // after the EEPROM_* slots in Menu.h
+const uint32_t CONFIG_COMMIT_DELAY = 2000;  // ms
+
+struct __attribute__((packed)) ConfigRecord {
+  uint16_t sequence;
+  uint8_t key;
+  int32_t value;
+  uint8_t crc;
+};
+
+class ConfigStore {
+  public:
+    void begin(uint16_t start = CONFIG_LOG_START, uint16_t end = E2END + 1);
+
+    bool has(byte key) { return key < CONFIG_KEYS && (_present & (1UL << key)); }
+    int32_t get(byte key, int32_t fallback) { return has(key) ? _value[key] : fallback; }
+    void set(byte key, int32_t value);
+
+    bool poll();
+    void flush() { while (_dirty && _records) commit(); }
+    bool dirty() { return _dirty != 0; }
+
+  private:
+    static uint8_t crc8(const uint8_t *data, byte length);
+    bool readRecord(uint16_t slot, ConfigRecord &record);
+    void commit();
+    int8_t keyAt(uint16_t slot);
+    void write(byte key);
+
+    int32_t _value[CONFIG_KEYS];
+    int16_t _slot[CONFIG_KEYS];     // where each key's newest record is, -1 for none
+    volatile uint32_t _present = 0;
+    volatile uint32_t _dirty = 0;
+    uint32_t _changedAt = 0;
+    uint16_t _start = 0;
+    uint16_t _records = 0;
+    uint16_t _head = 0;
+    uint16_t _sequence = 0;
+};
+
+uint8_t ConfigStore::crc8(const uint8_t *data, byte length) {
+  uint8_t crc = 0xFF;
+  while (length--) {
+    crc ^= *data++;
+    for (byte bit = 0; bit < 8; bit++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
+
+bool ConfigStore::readRecord(uint16_t slot, ConfigRecord &record) {
+  uint8_t *bytes = (uint8_t *)&record;
+  uint16_t address = _start + slot * sizeof(ConfigRecord);
+  for (byte i = 0; i < sizeof(ConfigRecord); i++) bytes[i] = EEPROM.read(address + i);
+  return record.key < CONFIG_KEYS && record.crc == crc8(bytes, sizeof(ConfigRecord) - 1);
+}
+
+void ConfigStore::begin(uint16_t start, uint16_t end) {
+  _start = start;
+  _records = (end - start) / sizeof(ConfigRecord);
+  _present = 0;
+  _dirty = 0;
+  for (byte k = 0; k < CONFIG_KEYS; k++) _slot[k] = -1;
+
+  uint16_t keySequence[CONFIG_KEYS];
+  int32_t newest = -1;
+  uint16_t newestSequence = 0;
+  for (uint16_t slot = 0; slot < _records; slot++) {
+    ConfigRecord record;
+    if (!readRecord(slot, record)) continue;
+    if (newest < 0 || (int16_t)(record.sequence - newestSequence) > 0) {
+      newest = slot;
+      newestSequence = record.sequence;
+    }
+    byte k = record.key;
+    if (_slot[k] < 0 || (int16_t)(record.sequence - keySequence[k]) > 0) {
+      _slot[k] = slot;
+      keySequence[k] = record.sequence;
+      _value[k] = record.value;
+      _present |= 1UL << k;
+    }
+  }
+  _head = newest < 0 ? 0 : (newest + 1) % _records;
+  _sequence = newestSequence + 1;
+  // Only after an earlier lap was cut short, it is carried on the next one
+  for (uint16_t i = 0; i < _records && keyAt(_head) >= 0; i++) _head = (_head + 1) % _records;
+}
+
+int8_t ConfigStore::keyAt(uint16_t slot) {
+  for (byte k = 0; k < CONFIG_KEYS; k++) {
+    if (_slot[k] == (int16_t)slot) return k;
+  }
+  return -1;
+}
+
+void ConfigStore::set(byte key, int32_t value) {
+  if (key >= CONFIG_KEYS) return;
+  if (has(key) && _value[key] == value) return;
+  __disable_irq();
+  _value[key] = value;
+  _present |= 1UL << key;
+  _dirty |= 1UL << key;
+  _changedAt = millis();
+  __enable_irq();
+}
+
+// Append a key's RAM value at the head
+void ConfigStore::write(byte key) {
+  __disable_irq();
+  ConfigRecord record;
+  record.sequence = _sequence;
+  record.key = key;
+  record.value = _value[key];
+  _dirty &= ~(1UL << key);
+  __enable_irq();
+  record.crc = crc8((const uint8_t *)&record, sizeof(ConfigRecord) - 1);
+
+  const uint8_t *bytes = (const uint8_t *)&record;
+  uint16_t address = _start + _head * sizeof(ConfigRecord);
+  for (byte i = 0; i < sizeof(ConfigRecord); i++) EEPROM.update(address + i, bytes[i]);
+
+  _slot[key] = _head;
+  _head = (_head + 1) % _records;
+  _sequence++;
+}
+
+// One record: carry forward the live record the head is about to reach,
+// otherwise the lowest dirty key
+void ConfigStore::commit() {
+  int8_t carry = keyAt((_head + 1) % _records);
+  if (carry >= 0) {
+    write(carry);
+    return;
+  }
+  for (byte k = 0; k < CONFIG_KEYS; k++) {
+    if (_dirty & (1UL << k)) {
+      write(k);
+      return;
+    }
+  }
+}
+
+// Call often from a thread that may block for a few milliseconds
+bool ConfigStore::poll() {
+  if (!_dirty || _records == 0) return false;
+  if (millis() - _changedAt < CONFIG_COMMIT_DELAY) return false;
+  commit();
+  return true;
+}
+
+#endif
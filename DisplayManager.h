@@ -4,7 +4,7 @@
 #include <SPI.h>
 #include <Wire.h>
 #include "ILI9341_t3.h"
-#include <Adafruit_FT6206.h>
+#include "TouchInput.h"
 #include "font_Arial.h"
 
 // TFT pins
@@ -17,23 +17,24 @@
 
 class DisplayManager {
   public:
-    DisplayManager();
+    DisplayManager(TouchInput &touch);
     void Setup();
     void Loop();
     void Init();
 
   private:
     ILI9341_t3 _tft = ILI9341_t3(TFT_CS, TFT_DC, TFT_RST, TFT_MOSI, TFT_SCLK, TFT_MISO);
-    Adafruit_FT6206 _ts = Adafruit_FT6206();
+    // Menu.h's touch: TouchInput has one interrupt, so there is only one of it
+    TouchInput &_touch;
 };
 
-DisplayManager::DisplayManager(){
+DisplayManager::DisplayManager(TouchInput &touch) : _touch(touch) {
 
 }
 
 void DisplayManager::Setup(){
   Serial.begin(9600);
-  _ts.begin(40);
+  // menuSetup() has already begun _touch
   _tft.begin();
   _tft.setClock(100000000);
   _tft.fillScreen(ILI9341_BLUE);
@@ -56,20 +57,16 @@ void DisplayManager::Setup(){
 }
 
 void DisplayManager::Loop(){
-  if (_ts.touched())
-  {   
-    // Retrieve a point  
-    TS_Point p = _ts.getPoint(); 
-    // rotate coordinate system
-    // flip it around to match the screen.
-    p.x = map(p.x, 0, 240, 240, 0);
-    p.y = map(p.y, 0, 320, 320, 0);
-    int y = _tft.height() - p.x;
-    int x = p.y;
-    Serial.print(x);
+  _touch.service();
+  TouchEvent event;
+  while (_touch.read(event))
+  {
+    // TouchInput has already turned it to screen coordinates
+    if (event.type != TOUCH_DOWN) continue;
+    Serial.print(event.x);
     Serial.print(", ");
-    Serial.println(y);
-  }  
+    Serial.println(event.y);
+  }
 }
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef DSP_UTIL_H__
+#define DSP_UTIL_H__
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+// Small integer helpers shared by the audio objects. Everything here must
+// also compile on the host so the DSP cores can be measured off target.
+
+// Clamp a 32 bit accumulator to the 16 bit sample range
+static inline int16_t saturate16(int32_t x) {
+  if (x > 32767) return 32767;
+  if (x < -32768) return -32768;
+  return x;
+}
+
+// Q15 multiply, rounded so feedback paths do not creep towards a DC offset
+static inline int32_t mulQ15(int32_t a, int32_t b) {
+  return (a * b + 0x4000) >> 15;
+}
+
+// Convert a 0..1 float to Q15, only used on parameter changes
+static inline int32_t floatToQ15(float x) {
+  if (x <= 0.0f) return 0;
+  if (x >= 1.0f) return 32767;
+  return (int32_t)(x * 32767.0f);
+}
+
+// Shared 1024 point sine with a guard point for the interpolation. Every
+// object that needs one calls sineTableInit() from its constructor.
+const uint16_t SINE_TABLE_SIZE = 1024;
+static int16_t sineTable[SINE_TABLE_SIZE + 1];
+
+static inline void sineTableInit() {
+  static bool ready = false;
+  if (ready) return;
+  for (uint16_t i = 0; i <= SINE_TABLE_SIZE; i++) {
+    sineTable[i] = 32767.0f * sinf(6.2831853f * i / SINE_TABLE_SIZE);
+  }
+  ready = true;
+}
+
+// Q15 sine of a full 32 bit phase, linearly interpolated
+static inline int32_t sineQ15(uint32_t phase) {
+  uint32_t index = phase >> 22;
+  int32_t frac = (phase >> 7) & 0x7FFF;
+  int32_t a = sineTable[index];
+  return a + (((sineTable[index + 1] - a) * frac) >> 15);
+}
+
+// Free running counter for benchmarks. On the Teensy this is the DWT cycle
+// counter, on the host it is a steady clock in nanoseconds.
+static inline void cycleCounterBegin() {
+#if defined(ARDUINO)
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+}
+
+static inline uint32_t cycleCount() {
+#if defined(ARDUINO)
+  return ARM_DWT_CYCCNT;
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef DUAL_OSC_H__
+#define DUAL_OSC_H__
+
+#include <stdlib.h>
+#include "DspUtil.h"
+
+// osc1 and osc2 of a voice in one object, so osc2 can hard sync to osc1
+// and be ring modulated by it.
+//
+// Both oscillators are 32 bit phase accumulators. Saw and pulse edges are
+// smoothed with polyBLEP, and so is the jump osc2 makes when osc1 wraps and
+// resets it, which is what keeps a swept sync lead from aliasing. The BLEP
+// has to correct the sample before a step as well as the one after, so the
+// output runs one sample late; a step is then found, measured and smoothed
+// in the same pass that renders it, and sync costs a couple of compares
+// per sample over two free running oscillators.
+//
+// Output 0 is osc1. Output 1 is osc2 crossfaded into the ring product
+// osc1 * osc2 by ring(), so the ring sound takes osc2's mixer channel.
+
+enum DualOscShape {
+  DUAL_OSC_SINE = 0,
+  DUAL_OSC_TRIANGLE,
+  DUAL_OSC_SAW,
+  DUAL_OSC_PULSE
+};
+
+struct DualOscStats {
+  uint32_t cyclesFree;  // per block, cycles on the Teensy, nanoseconds on the host
+  uint32_t cyclesSync;
+};
+
+class DualOscCore {
+  public:
+    DualOscCore() {
+      sineTableInit();
+      _osc[0].shape = DUAL_OSC_SAW;
+      _osc[1].shape = DUAL_OSC_SAW;
+    }
+
+    void shape(uint8_t osc, uint8_t shape) { if (osc < 2) _osc[osc].shape = shape; }
+    void frequency(uint8_t osc, float hz, float sampleRate);
+    void pulseWidth(uint8_t osc, float width);
+    void amplitude(float level) { _amplitude = floatToQ15(level); }
+    void sync(bool on) { _sync = on; }
+    void ring(float amount) { _ring = floatToQ15(amount); }
+    bool sync() { return _sync; }
+    bool silent() { return _amplitude == 0; }
+
+    void process(int16_t *out1, int16_t *out2, uint16_t count);
+
+  private:
+    struct Osc {
+      uint32_t phase = 0;
+      uint32_t increment = 0;
+      uint32_t width = 0x80000000;
+      float perIncrement = 0;  // 1 / increment, for where in the sample a step fell
+      int32_t pending = 0;     // the sample held back for the BLEP
+      uint8_t shape;
+    };
+
+    static int32_t naive(const Osc &osc, uint32_t phase);
+    static void blep(int32_t &before, int32_t &after, float d, int32_t jump);
+    int32_t advance(Osc &osc, int32_t &before, bool &wrapped, float &d);
+
+    Osc _osc[2];
+    int32_t _amplitude = 32767;
+    int32_t _ring = 0;
+    bool _sync = false;
+};
+
+void DualOscCore::frequency(uint8_t osc, float hz, float sampleRate) {
+  if (osc >= 2) return;
+  if (hz < 0.0f) hz = 0.0f;
+  if (hz > sampleRate * 0.5f) hz = sampleRate * 0.5f;
+  uint32_t increment = hz * (4294967296.0f / sampleRate);
+  _osc[osc].increment = increment;
+  _osc[osc].perIncrement = increment ? 1.0f / increment : 0.0f;
+}
+
+void DualOscCore::pulseWidth(uint8_t osc, float width) {
+  if (osc >= 2) return;
+  if (width < 0.01f) width = 0.01f;
+  if (width > 0.99f) width = 0.99f;
+  _osc[osc].width = width * 4294967296.0f;
+}
+
+// The waveform with no band limiting
+int32_t DualOscCore::naive(const Osc &osc, uint32_t phase) {
+  switch (osc.shape) {
+    case DUAL_OSC_SINE:
+      return sineQ15(phase);
+    case DUAL_OSC_TRIANGLE: {
+      int32_t v = phase >> 15;
+      return v < 65536 ? v - 32768 : 98303 - v;
+    }
+    case DUAL_OSC_PULSE:
+      return phase < osc.width ? 32767 : -32768;
+    default:
+      return (int32_t)(phase >> 16) - 32768;
+  }
+}
+
+// A step of jump happened d samples before the after sample, 0 <= d < 1
+void DualOscCore::blep(int32_t &before, int32_t &after, float d, int32_t jump) {
+  float half = jump * 0.5f;
+  before += (int32_t)(half * d * d);
+  after -= (int32_t)(half * (1.0f - d) * (1.0f - d));
+}
+
+// One sample of a free running oscillator, smoothing its own edges
+int32_t DualOscCore::advance(Osc &osc, int32_t &before, bool &wrapped, float &d) {
+  uint32_t last = osc.phase;
+  uint32_t phase = last + osc.increment;
+  osc.phase = phase;
+  int32_t value = naive(osc, phase);
+
+  wrapped = phase < last;
+  if (wrapped) {
+    d = phase * osc.perIncrement;
+    if (osc.shape == DUAL_OSC_SAW) blep(before, value, d, -65535);
+    else if (osc.shape == DUAL_OSC_PULSE) blep(before, value, d, 65535);
+  }
+  if (osc.shape == DUAL_OSC_PULSE && phase >= osc.width && (last < osc.width || wrapped)) {
+    blep(before, value, (phase - osc.width) * osc.perIncrement, -65535);
+  }
+  return value;
+}
+
+void DualOscCore::process(int16_t *out1, int16_t *out2, uint16_t count) {
+  Osc &a = _osc[0];
+  Osc &b = _osc[1];
+  int32_t pendingA = a.pending;
+  int32_t pendingB = b.pending;
+
+  for (uint16_t n = 0; n < count; n++) {
+    bool wrapped;
+    float d;
+    int32_t valueA = advance(a, pendingA, wrapped, d);
+
+    int32_t valueB;
+    if (_sync && wrapped) {
+      // osc1 wrapped d samples ago. osc2 restarts from zero at that moment
+      // and has run on for d samples since; its own edges in the part of
+      // the sample before the reset are left to the reset step.
+      uint32_t atReset = b.phase + (uint32_t)((1.0f - d) * b.increment);
+      b.phase = (uint32_t)(d * b.increment);
+      valueB = naive(b, b.phase);
+      blep(pendingB, valueB, d, naive(b, 0) - naive(b, atReset));
+    } else {
+      bool wrappedB;
+      float dB;
+      valueB = advance(b, pendingB, wrappedB, dB);
+    }
+
+    int32_t oscA = saturate16(pendingA);
+    int32_t oscB = saturate16(pendingB);
+    int32_t ring = mulQ15(oscA, oscB);
+    out1[n] = mulQ15(oscA, _amplitude);
+    out2[n] = mulQ15(oscB + mulQ15(ring - oscB, _ring), _amplitude);
+
+    pendingA = valueA;
+    pendingB = valueB;
+  }
+
+  a.pending = pendingA;
+  b.pending = pendingB;
+}
+
+// Render the same pair free running and synced on a core of its own and
+// report both costs. The oscillators in the audio graph are left alone.
+DualOscStats dualOscMeasure(uint16_t blocks, float sampleRate) {
+  static int16_t out1[128];
+  static int16_t out2[128];
+  DualOscCore osc;
+  DualOscStats stats = {0, 0};
+
+  osc.shape(0, DUAL_OSC_SAW);
+  osc.shape(1, DUAL_OSC_PULSE);
+  osc.frequency(0, 110.0f, sampleRate);
+  osc.frequency(1, 377.0f, sampleRate);
+  osc.ring(0.5);
+
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    osc.sync(pass == 1);
+    uint32_t cycles = 0;
+    for (uint16_t b = 0; b < blocks; b++) {
+      uint32_t start = cycleCount();
+      osc.process(out1, out2, 128);
+      cycles += cycleCount() - start;
+    }
+    if (pass == 0) stats.cyclesFree = cycles / blocks;
+    else stats.cyclesSync = cycles / blocks;
+  }
+  return stats;
+}
+
+#if defined(ARDUINO)
+#include <Audio.h>
+
+// No inputs, output 0 is osc1 and output 1 is osc2 or its ring product
+class AudioSynthDualOsc : public AudioStream {
+  public:
+    AudioSynthDualOsc() : AudioStream(0, NULL) {}
+    virtual void update(void);
+
+    void begin(uint8_t osc, uint8_t shape) { _osc.shape(osc, shape); }
+    void frequency(uint8_t osc, float hz) { _osc.frequency(osc, hz, AUDIO_SAMPLE_RATE_EXACT); }
+    void pulseWidth(uint8_t osc, float width) { _osc.pulseWidth(osc, width); }
+    void amplitude(float level) { _osc.amplitude(level); }
+    void sync(bool on) { _osc.sync(on); }
+    void ring(float amount) { _osc.ring(amount); }
+
+    DualOscCore &core() { return _osc; }
+
+  private:
+    DualOscCore _osc;
+};
+
+// Like the library's oscillators, no blocks at all at zero amplitude
+void AudioSynthDualOsc::update(void) {
+  if (_osc.silent()) return;
+  audio_block_t *out1 = allocate();
+  audio_block_t *out2 = allocate();
+  if (out1 && out2) {
+    _osc.process(out1->data, out2->data, AUDIO_BLOCK_SAMPLES);
+    transmit(out1, 0);
+    transmit(out2, 1);
+  }
+  if (out1) release(out1);
+  if (out2) release(out2);
+}
+#endif
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef ENSEMBLE_CHORUS_H__
+#define ENSEMBLE_CHORUS_H__
+
+#include <Audio.h>
+#include "DspUtil.h"
+
+// Stereo ensemble chorus.
+//
+// Both inputs are summed into one short delay line and read back by three
+// taps. The taps are swept by a single quadrature LFO: sin and cos come from
+// a "magic circle" recursion (two multiplies per sample) and the 120 and 240
+// degree taps are built from them, so there is no sine table or second LFO.
+// Each tap reads between two samples with linear interpolation.
+//
+// The left output gets tap 0 and half of tap 1, the right gets tap 2 and the
+// other half, added on top of the dry signal.
+
+const uint16_t ENSEMBLE_BUFFER_SAMPLES = 2048;  // power of 2, ~46ms
+const uint16_t ENSEMBLE_BUFFER_MASK = ENSEMBLE_BUFFER_SAMPLES - 1;
+
+class AudioEffectEnsemble : public AudioStream {
+  public:
+    AudioEffectEnsemble() : AudioStream(2, inputQueueArray) {
+      memset(_buffer, 0, sizeof(_buffer));
+      rate(0.6);
+      delay(12.0);
+      depth(3.0);
+    }
+    virtual void update(void);
+
+    void rate(float hz);
+    void delay(float milliseconds);
+    void depth(float milliseconds);
+    void mix(float wet) { _wet = floatToQ15(wet); }
+
+  private:
+    audio_block_t *inputQueueArray[2];
+    int16_t _buffer[ENSEMBLE_BUFFER_SAMPLES];
+    uint16_t _writeIndex = 0;
+    uint8_t _idleBlocks = 0;
+
+    // LFO state and step, Q30
+    int32_t _sin = 0;
+    int32_t _cos = 1 << 30;
+    int32_t _step = 0;
+
+    int32_t _centerQ16 = 0;  // centre delay in samples, Q16
+    int32_t _depthQ4 = 0;    // sweep depth in samples, Q4
+    int32_t _wet = 0;        // Q15
+};
+
+void AudioEffectEnsemble::rate(float hz) {
+  _step = (int32_t)(6.2831853f * hz / AUDIO_SAMPLE_RATE_EXACT * 1073741824.0f);
+}
+
+void AudioEffectEnsemble::delay(float milliseconds) {
+  float samples = milliseconds * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f);
+  if (samples < 2.0f) samples = 2.0f;
+  _centerQ16 = samples * 65536.0f;
+}
+
+void AudioEffectEnsemble::depth(float milliseconds) {
+  _depthQ4 = milliseconds * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f) * 16.0f;
+}
+
+void AudioEffectEnsemble::update(void) {
+  audio_block_t *inL = receiveWritable(0);
+  audio_block_t *inR = receiveWritable(1);
+  if (!inL && !inR) {
+    // Nothing playing, run on silence only until the line has drained
+    if (_idleBlocks >= ENSEMBLE_BUFFER_SAMPLES / AUDIO_BLOCK_SAMPLES) return;
+    _idleBlocks++;
+  } else {
+    _idleBlocks = 0;
+  }
+  if (!inL) {
+    inL = allocate();
+    if (!inL) { if (inR) release(inR); return; }
+    memset(inL->data, 0, sizeof(inL->data));
+  }
+  if (!inR) {
+    inR = allocate();
+    if (!inR) { release(inL); return; }
+    memset(inR->data, 0, sizeof(inR->data));
+  }
+
+  // Keep the sweep inside the line and away from the write head
+  int32_t maxDelay = (int32_t)(ENSEMBLE_BUFFER_SAMPLES - 2) << 16;
+  int32_t center = _centerQ16;
+  int32_t sweep = _depthQ4 << 12;
+  if (center - sweep < (2 << 16)) sweep = center - (2 << 16);
+  if (center + sweep > maxDelay) sweep = maxDelay - center;
+  int32_t depthQ4 = sweep >> 12;
+
+  for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES; n++) {
+    _buffer[_writeIndex] = ((int32_t)inL->data[n] + inR->data[n]) >> 1;
+
+    // Quadrature LFO, then taps at 0, 120 and 240 degrees
+    _sin += ((int64_t)_step * _cos) >> 30;
+    _cos -= ((int64_t)_step * _sin) >> 30;
+    int32_t s = _sin >> 15;
+    int32_t c = _cos >> 15;
+    int32_t lfo[3];
+    lfo[0] = s;
+    lfo[1] = mulQ15(c, 28378) - (s >> 1);   // sin(x + 120)
+    lfo[2] = -mulQ15(c, 28378) - (s >> 1);  // sin(x + 240)
+
+    int32_t tap[3];
+    for (uint8_t t = 0; t < 3; t++) {
+      uint32_t readPos = ((uint32_t)_writeIndex << 16) - (uint32_t)(center + ((depthQ4 * lfo[t]) >> 3));
+      uint16_t index = (readPos >> 16) & ENSEMBLE_BUFFER_MASK;
+      int32_t frac = (readPos & 0xFFFF) >> 1;
+      int32_t a = _buffer[index];
+      int32_t b = _buffer[(index + 1) & ENSEMBLE_BUFFER_MASK];
+      tap[t] = a + (((b - a) * frac) >> 15);
+    }
+
+    int32_t half = tap[1] >> 1;
+    inL->data[n] = saturate16(inL->data[n] + mulQ15(tap[0] + half, _wet));
+    inR->data[n] = saturate16(inR->data[n] + mulQ15(tap[2] + half, _wet));
+
+    _writeIndex = (_writeIndex + 1) & ENSEMBLE_BUFFER_MASK;
+  }
+
+  transmit(inL, 0);
+  transmit(inR, 1);
+  release(inL);
+  release(inR);
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef ENVELOPE_BANK_H__
+#define ENVELOPE_BANK_H__
+
+#include <Audio.h>
+#include <math.h>
+
+// Exponential ADSR for every voice in one object.
+//
+// Each segment is the one pole recursion level += (target - level) * coef,
+// one multiply per sample. The target sits past the point where the segment
+// ends (above full scale for the attack, below the sustain level for the
+// decay, below zero for the release) so the curve reaches its end in the
+// set time instead of creeping up on it forever. How far past is the
+// curvature: a target far away gives a gentle curve, a close one a strongly
+// exponential shape.
+//
+// Level is Q30. Coefficients only change when a time, the curvature or the
+// velocity response changes, velocity itself scales them with one integer
+// multiply on noteOn.
+
+const byte ENVELOPE_BANK_VOICES = 8;
+const int32_t ENVELOPE_ONE = 1 << 30;
+
+enum EnvelopeStage {
+  ENVELOPE_IDLE = 0,
+  ENVELOPE_ATTACK,
+  ENVELOPE_DECAY,
+  ENVELOPE_SUSTAIN,
+  ENVELOPE_RELEASE
+};
+
+class AudioEffectEnvelopeBank : public AudioStream {
+  public:
+    AudioEffectEnvelopeBank() : AudioStream(ENVELOPE_BANK_VOICES, inputQueueArray) {
+      for (byte i = 0; i < ENVELOPE_BANK_VOICES; i++) {
+        _voice[i].attackMs = 10;
+        _voice[i].decayMs = 0;
+        _voice[i].releaseMs = 300;
+        _voice[i].sustain = ENVELOPE_ONE;
+      }
+      curve(0.5);
+      velocityTime(0);
+    }
+    virtual void update(void);
+
+    void noteOn(byte voice, byte velocity = 127);
+    void noteOff(byte voice);
+
+    void attack(byte voice, float milliseconds);
+    void decay(byte voice, float milliseconds);
+    void sustain(byte voice, float level);
+    void releaseTime(byte voice, float milliseconds);
+
+    // 0 gentle .. 1 strongly exponential, all voices
+    void curve(float amount);
+    // 0 off .. 1 hardest notes run attack and decay four times as fast
+    void velocityTime(float amount);
+
+    bool isActive(byte voice) { return voice < ENVELOPE_BANK_VOICES && _voice[voice].stage != ENVELOPE_IDLE; }
+
+  private:
+    struct Voice {
+      volatile byte stage = ENVELOPE_IDLE;
+      int32_t level = 0;
+      int32_t target = 0;
+      int32_t coef = 0;
+      int32_t attackCoef;
+      int32_t decayCoef;
+      int32_t releaseCoef;
+      int32_t velocityQ12 = 4096;
+      int32_t sustain;
+      float attackMs;
+      float decayMs;
+      float releaseMs;
+    };
+
+    int32_t coefficient(float milliseconds, float ratio);
+    void updateCoefficients(byte voice);
+    void enter(Voice &v, byte stage);
+
+    audio_block_t *inputQueueArray[ENVELOPE_BANK_VOICES];
+    Voice _voice[ENVELOPE_BANK_VOICES];
+    float _attackRatio;
+    float _decayRatio;
+    int32_t _attackOvershoot;  // Q30
+    int32_t _decayUndershoot;  // Q30
+    int16_t _velocityQ12[128];
+};
+
+// Coefficient that covers the segment in the given time
+int32_t AudioEffectEnvelopeBank::coefficient(float milliseconds, float ratio) {
+  float samples = milliseconds * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f);
+  if (samples < 1.0f) return ENVELOPE_ONE;
+  return (1.0f - expf(-logf((1.0f + ratio) / ratio) / samples)) * ENVELOPE_ONE;
+}
+
+void AudioEffectEnvelopeBank::updateCoefficients(byte voice) {
+  Voice &v = _voice[voice];
+  int32_t attack = coefficient(v.attackMs, _attackRatio);
+  int32_t decay = coefficient(v.decayMs, _decayRatio);
+  int32_t release = coefficient(v.releaseMs, _decayRatio);
+  __disable_irq();
+  v.attackCoef = attack;
+  v.decayCoef = decay;
+  v.releaseCoef = release;
+  __enable_irq();
+}
+
+void AudioEffectEnvelopeBank::attack(byte voice, float milliseconds) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  _voice[voice].attackMs = milliseconds;
+  updateCoefficients(voice);
+}
+
+void AudioEffectEnvelopeBank::decay(byte voice, float milliseconds) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  _voice[voice].decayMs = milliseconds;
+  updateCoefficients(voice);
+}
+
+void AudioEffectEnvelopeBank::releaseTime(byte voice, float milliseconds) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  _voice[voice].releaseMs = milliseconds;
+  updateCoefficients(voice);
+}
+
+void AudioEffectEnvelopeBank::sustain(byte voice, float level) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  if (level < 0.0f) level = 0.0f;
+  if (level > 1.0f) level = 1.0f;
+  _voice[voice].sustain = level * ENVELOPE_ONE;
+}
+
+void AudioEffectEnvelopeBank::curve(float amount) {
+  if (amount < 0.0f) amount = 0.0f;
+  if (amount > 1.0f) amount = 1.0f;
+  // Overshoot from 90% of full scale down to 0.01%, the most Q30 allows
+  _attackRatio = 0.9f * powf(0.0001f / 0.9f, amount);
+  _decayRatio = _attackRatio * 0.1f;
+  _attackOvershoot = _attackRatio * ENVELOPE_ONE;
+  _decayUndershoot = _decayRatio * ENVELOPE_ONE;
+  for (byte i = 0; i < ENVELOPE_BANK_VOICES; i++) updateCoefficients(i);
+}
+
+void AudioEffectEnvelopeBank::velocityTime(float amount) {
+  if (amount < 0.0f) amount = 0.0f;
+  if (amount > 1.0f) amount = 1.0f;
+  for (byte i = 0; i < 128; i++) {
+    _velocityQ12[i] = 4096.0f / (1.0f - 0.75f * amount * (i / 127.0f));
+  }
+}
+
+void AudioEffectEnvelopeBank::enter(Voice &v, byte stage) {
+  v.stage = stage;
+  switch (stage) {
+    case ENVELOPE_ATTACK:
+      v.target = ENVELOPE_ONE + _attackOvershoot;
+      v.coef = ((int64_t)v.attackCoef * v.velocityQ12) >> 12;
+      break;
+    case ENVELOPE_DECAY:
+      v.target = v.sustain - _decayUndershoot;
+      v.coef = ((int64_t)v.decayCoef * v.velocityQ12) >> 12;
+      break;
+    case ENVELOPE_SUSTAIN:
+      v.target = v.sustain;
+      break;
+    case ENVELOPE_RELEASE:
+      v.target = -_decayUndershoot;
+      v.coef = v.releaseCoef;
+      break;
+    default: // idle, holds at zero for the rest of the block
+      v.level = 0;
+      v.target = 0;
+      v.coef = 0;
+      break;
+  }
+  if (v.coef > ENVELOPE_ONE) v.coef = ENVELOPE_ONE;
+}
+
+// Retriggers from wherever the voice is, no click back to zero
+void AudioEffectEnvelopeBank::noteOn(byte voice, byte velocity) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  Voice &v = _voice[voice];
+  __disable_irq();
+  v.velocityQ12 = _velocityQ12[velocity & 127];
+  enter(v, ENVELOPE_ATTACK);
+  __enable_irq();
+}
+
+void AudioEffectEnvelopeBank::noteOff(byte voice) {
+  if (voice >= ENVELOPE_BANK_VOICES) return;
+  Voice &v = _voice[voice];
+  __disable_irq();
+  if (v.stage != ENVELOPE_IDLE) enter(v, ENVELOPE_RELEASE);
+  __enable_irq();
+}
+
+void AudioEffectEnvelopeBank::update(void) {
+  for (byte i = 0; i < ENVELOPE_BANK_VOICES; i++) {
+    Voice &v = _voice[i];
+    audio_block_t *block = receiveWritable(i);
+    if (!block) continue;
+    if (v.stage == ENVELOPE_IDLE) {
+      release(block);
+      continue;
+    }
+
+    int32_t level = v.level;
+    int16_t *data = block->data;
+    for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES; n++) {
+      level += ((int64_t)(v.target - level) * v.coef) >> 30;
+
+      // Segment ends, checked against the real end point not the target
+      if (v.stage == ENVELOPE_ATTACK && level >= ENVELOPE_ONE) {
+        level = ENVELOPE_ONE;
+        enter(v, ENVELOPE_DECAY);
+      } else if (v.stage == ENVELOPE_DECAY && level <= v.sustain) {
+        level = v.sustain;
+        enter(v, ENVELOPE_SUSTAIN);
+      } else if (v.stage == ENVELOPE_RELEASE && level <= 0) {
+        level = 0;
+        enter(v, ENVELOPE_IDLE);
+      }
+
+      data[n] = (data[n] * (level >> 15)) >> 15;
+    }
+    v.level = level;
+
+    transmit(block, i);
+    release(block);
+  }
+}
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef FDN_REVERB_H__
+#define FDN_REVERB_H__
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DspUtil.h"
+
+// Integer feedback delay network reverb.
+//
+// The input is summed to mono, smeared by a chain of allpass diffusers and
+// fed into 2, 4 or 8 delay lines that are mixed back through a Hadamard
+// matrix (adds and shifts only). Each line has a one pole damping filter and
+// a decay gain scaled to its length so the tail decays evenly.
+//
+// All delay memory lives in one static array of REVERB_RAM_BYTES. The line
+// lengths are spread over that budget whenever quality() changes, so a
+// smaller budget gives a smaller room instead of a build failure.
+
+// Override before including to trade RAM for room size
+#ifndef REVERB_RAM_BYTES
+#define REVERB_RAM_BYTES 32768
+#endif
+
+const uint8_t REVERB_MAX_LINES = 8;
+const uint8_t REVERB_MAX_DIFFUSERS = 4;
+const uint32_t REVERB_MEMORY_SAMPLES = REVERB_RAM_BYTES / 2;
+
+// Relative lengths, scaled to the RAM budget and rounded down to primes
+const uint16_t REVERB_LINE_BASE[REVERB_MAX_LINES] = {1031, 1327, 1523, 1801, 2053, 2399, 2713, 3089};
+const uint16_t REVERB_DIFFUSER_BASE[REVERB_MAX_DIFFUSERS] = {142, 107, 379, 277};
+
+struct ReverbStats {
+  uint32_t cyclesPerBlock;  // cycles on the Teensy, nanoseconds on the host
+  uint32_t decayMs;         // time for an impulse to fall by 60dB
+  uint16_t echoDensity;     // non-silent samples per 1000 in the first 100ms
+};
+
+class FdnReverb {
+  public:
+    FdnReverb();
+
+    void quality(uint8_t lines, uint8_t diffusers);
+    void roomSize(float size);
+    void damping(float amount);
+    void mix(float wet);
+    void clear();
+
+    void process(const int16_t *inL, const int16_t *inR, int16_t *outL, int16_t *outR, uint16_t count);
+
+    uint8_t lines() { return _lines; }
+    uint8_t diffusers() { return _diffusers; }
+    uint32_t memoryUsed() { return _memoryUsed * 2; }
+
+  private:
+    struct DelayLine {
+      int16_t *buffer;
+      uint16_t length;
+      uint16_t index;
+    };
+
+    static uint16_t primeBelow(uint32_t n);
+    void updateGains();
+
+    int16_t _memory[REVERB_MEMORY_SAMPLES];
+    uint32_t _memoryUsed = 0;
+
+    DelayLine _line[REVERB_MAX_LINES];
+    DelayLine _diffuser[REVERB_MAX_DIFFUSERS];
+    int32_t _lowpass[REVERB_MAX_LINES];
+    int32_t _gain[REVERB_MAX_LINES];
+
+    uint8_t _lines = 4;
+    uint8_t _diffusers = 2;
+    uint8_t _outShift = 1;
+    int32_t _norm = 16384;   // Q15, 1/sqrt(lines)
+
+    float _size = 0.5;
+    int32_t _damp = 22000;   // Q15, 32767 = no damping
+    int32_t _wet = 0;        // Q15
+};
+
+FdnReverb::FdnReverb() {
+  quality(_lines, _diffusers);
+  roomSize(_size);
+}
+
+uint16_t FdnReverb::primeBelow(uint32_t n) {
+  if (n > 65521) n = 65521;
+  if (n < 3) return 3;
+  for (; n > 3; n--) {
+    bool prime = (n & 1);
+    for (uint32_t d = 3; prime && d * d <= n; d += 2) {
+      if (n % d == 0) prime = false;
+    }
+    if (prime) break;
+  }
+  return n;
+}
+
+// Change the number of lines (2, 4 or 8) and diffusers (0..4). This
+// re-spreads the RAM budget, so the tail is cleared. Not for the audio path.
+// Asking for the layout already in use changes nothing, tail included.
+void FdnReverb::quality(uint8_t lines, uint8_t diffusers) {
+  if (lines >= 8) lines = 8;
+  else if (lines >= 4) lines = 4;
+  else lines = 2;
+  if (diffusers > REVERB_MAX_DIFFUSERS) diffusers = REVERB_MAX_DIFFUSERS;
+  if (_memoryUsed && lines == _lines && diffusers == _diffusers) return;
+
+  _lines = lines;
+  _diffusers = diffusers;
+  _outShift = (lines == 8) ? 2 : (lines == 4) ? 1 : 0;
+  _norm = (lines == 8) ? 11585 : (lines == 4) ? 16384 : 23170;
+
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < _lines; i++) total += REVERB_LINE_BASE[i];
+  for (uint8_t i = 0; i < _diffusers; i++) total += REVERB_DIFFUSER_BASE[i];
+
+  // Q8 scale so the sum of all lengths fits the budget
+  uint32_t scale = (REVERB_MEMORY_SAMPLES << 8) / total;
+
+  int16_t *next = _memory;
+  for (uint8_t i = 0; i < _lines; i++) {
+    _line[i].buffer = next;
+    _line[i].length = primeBelow((REVERB_LINE_BASE[i] * scale) >> 8);
+    _line[i].index = 0;
+    next += _line[i].length;
+  }
+  for (uint8_t i = 0; i < _diffusers; i++) {
+    _diffuser[i].buffer = next;
+    _diffuser[i].length = primeBelow((REVERB_DIFFUSER_BASE[i] * scale) >> 8);
+    _diffuser[i].index = 0;
+    next += _diffuser[i].length;
+  }
+  _memoryUsed = next - _memory;
+
+  clear();
+  updateGains();
+}
+
+void FdnReverb::clear() {
+  memset(_memory, 0, sizeof(_memory));
+  memset(_lowpass, 0, sizeof(_lowpass));
+}
+
+// 0..1, sets the feedback of the longest line, shorter lines decay less per pass
+void FdnReverb::roomSize(float size) {
+  if (size < 0.0f) size = 0.0f;
+  if (size > 1.0f) size = 1.0f;
+  _size = size;
+  updateGains();
+}
+
+void FdnReverb::updateGains() {
+  float feedback = 0.70f + (0.28f * _size);
+  float longest = _line[_lines - 1].length;
+  for (uint8_t i = 0; i < _lines; i++) {
+    _gain[i] = floatToQ15(powf(feedback, _line[i].length / longest));
+  }
+}
+
+// 0..1, amount of high frequency loss per pass through the network
+void FdnReverb::damping(float amount) {
+  _damp = floatToQ15(1.0f - (0.9f * amount));
+}
+
+// 0..1, wet level added on top of the dry signal
+void FdnReverb::mix(float wet) {
+  _wet = floatToQ15(wet);
+}
+
+void FdnReverb::process(const int16_t *inL, const int16_t *inR, int16_t *outL, int16_t *outR, uint16_t count) {
+  const int32_t diffuserGain = 20480; // 0.625 in Q15
+  int32_t tap[REVERB_MAX_LINES];
+
+  for (uint16_t n = 0; n < count; n++) {
+    int32_t x = ((int32_t)inL[n] + inR[n]) >> 2;
+
+    // Input diffusion, Schroeder allpasses in series
+    for (uint8_t d = 0; d < _diffusers; d++) {
+      DelayLine &ap = _diffuser[d];
+      int32_t delayed = ap.buffer[ap.index];
+      int32_t w = x + mulQ15(delayed, diffuserGain);
+      ap.buffer[ap.index] = saturate16(w);
+      x = delayed - mulQ15(w, diffuserGain);
+      if (++ap.index >= ap.length) ap.index = 0;
+    }
+
+    int32_t wetL = 0;
+    int32_t wetR = 0;
+    for (uint8_t i = 0; i < _lines; i += 2) {
+      tap[i] = _line[i].buffer[_line[i].index];
+      tap[i + 1] = _line[i + 1].buffer[_line[i + 1].index];
+      wetL += tap[i];
+      wetR += tap[i + 1];
+    }
+
+    // In place fast Hadamard transform, normalised by 1/sqrt(lines)
+    for (uint8_t h = 1; h < _lines; h <<= 1) {
+      for (uint8_t i = 0; i < _lines; i += (h << 1)) {
+        for (uint8_t j = i; j < i + h; j++) {
+          int32_t a = tap[j];
+          int32_t b = tap[j + h];
+          tap[j] = a + b;
+          tap[j + h] = a - b;
+        }
+      }
+    }
+
+    for (uint8_t i = 0; i < _lines; i++) {
+      // The transform can reach lines * 32767, too big for mulQ15 with 8 lines,
+      // and the result is clamped so the damping filter stays in range too
+      int32_t f = saturate16(((int64_t)tap[i] * _norm + 0x4000) >> 15);
+
+      _lowpass[i] += mulQ15(f - _lowpass[i], _damp);
+      int32_t w = mulQ15(_lowpass[i], _gain[i]) + ((i & 1) ? -x : x);
+
+      DelayLine &line = _line[i];
+      line.buffer[line.index] = saturate16(w);
+      if (++line.index >= line.length) line.index = 0;
+    }
+
+    outL[n] = saturate16(inL[n] + mulQ15(wetL >> _outShift, _wet));
+    outR[n] = saturate16(inR[n] + mulQ15(wetR >> _outShift, _wet));
+  }
+}
+
+// Feed an impulse through a reverb of its own, set up like this, and report
+// cost and tail quality. The one in the audio graph is left alone.
+ReverbStats reverbMeasure(uint8_t lines, uint8_t diffusers, float size, float damping,
+                          uint16_t blockSize, uint32_t sampleRate) {
+  static FdnReverb reverb;  // too big for the stack
+  static int16_t in[128];
+  static int16_t outL[128];
+  static int16_t outR[128];
+  ReverbStats stats = {0, 0, 0};
+
+  if (blockSize > 128) blockSize = 128;
+  reverb.quality(lines, diffusers);
+  reverb.roomSize(size);
+  reverb.damping(damping);
+  reverb.mix(1.0);
+  reverb.clear();
+
+  const uint32_t densityWindow = sampleRate / 10;
+  const uint32_t maxSamples = sampleRate * 10;
+  uint32_t cycles = 0;
+  uint32_t blocks = 0;
+  uint32_t lastLoud = 0;
+  uint32_t nonSilent = 0;
+
+  for (uint32_t pos = 0; pos < maxSamples; pos += blockSize) {
+    memset(in, 0, sizeof(in));
+    if (pos == 0) in[0] = 16384;
+
+    uint32_t start = cycleCount();
+    reverb.process(in, in, outL, outR, blockSize);
+    cycles += cycleCount() - start;
+    blocks++;
+
+    for (uint16_t n = 0; n < blockSize; n++) {
+      int16_t level = abs(outL[n] - in[n]);
+      if (pos + n < densityWindow && level > 0) nonSilent++;
+      if (level > 16) lastLoud = pos + n; // 16384 / 1000 = -60dB
+    }
+    if (pos > lastLoud + sampleRate) break;
+  }
+
+  stats.cyclesPerBlock = cycles / blocks;
+  stats.decayMs = (uint64_t)lastLoud * 1000 / sampleRate;
+  stats.echoDensity = (uint64_t)nonSilent * 1000 / densityWindow;
+  return stats;
+}
+
+#if defined(ARDUINO)
+#include <Audio.h>
+
+// Two inputs, two outputs. The dry signal passes straight through on each
+// side and the mono tank is added on top.
+class AudioEffectFdnReverb : public AudioStream {
+  public:
+    AudioEffectFdnReverb() : AudioStream(2, inputQueueArray) {}
+    virtual void update(void);
+
+    // Only holds off the audio interrupt, the clear is too long to mask them all
+    void quality(uint8_t lines, uint8_t diffusers) {
+      AudioNoInterrupts();
+      _reverb.quality(lines, diffusers);
+      AudioInterrupts();
+    }
+    void roomSize(float size) { _reverb.roomSize(size); }
+    void damping(float amount) { _reverb.damping(amount); }
+    void mix(float wet) { _reverb.mix(wet); }
+
+    uint32_t cyclesPerBlock() { return _cycles; }
+    uint32_t cyclesPerBlockMax() { return _cyclesMax; }
+    void cyclesPerBlockMaxReset() { _cyclesMax = 0; }
+    FdnReverb &core() { return _reverb; }
+
+  private:
+    audio_block_t *inputQueueArray[2];
+    FdnReverb _reverb;
+    volatile uint32_t _cycles = 0;
+    volatile uint32_t _cyclesMax = 0;
+};
+
+void AudioEffectFdnReverb::update(void) {
+  static const int16_t silence[AUDIO_BLOCK_SAMPLES] = {0};
+
+  audio_block_t *inL = receiveReadOnly(0);
+  audio_block_t *inR = receiveReadOnly(1);
+  audio_block_t *outL = allocate();
+  audio_block_t *outR = allocate();
+
+  if (outL && outR) {
+    uint32_t start = cycleCount();
+    _reverb.process(inL ? inL->data : silence, inR ? inR->data : silence,
+                    outL->data, outR->data, AUDIO_BLOCK_SAMPLES);
+    _cycles = cycleCount() - start;
+    if (_cycles > _cyclesMax) _cyclesMax = _cycles;
+
+    transmit(outL, 0);
+    transmit(outR, 1);
+  }
+
+  if (outL) release(outL);
+  if (outR) release(outR);
+  if (inL) release(inL);
+  if (inR) release(inR);
+}
+#endif
+
+#endif
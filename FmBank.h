@@ -0,0 +1,378 @@
+#ifndef FM_BANK_H__
+#define FM_BANK_H__
+
+#include <math.h>
+#include <string.h>
+#include "DspUtil.h"
+
+// Phase modulation synthesis for every voice in one object.
+//
+// Each voice has up to four operators wired by one of FM_ALGORITHMS fixed
+// algorithms. An operator is a phase accumulator read through the shared
+// 1024 point sine table with linear interpolation; the outputs of the
+// operators that modulate it are added to its phase. Operator 3 can also
+// modulate itself (feedback).
+//
+// Every operator has its own ADSR, run once per block and ramped linearly
+// across it, so its level costs one add per sample. All operators of all
+// voices are rendered in one pass, which keeps the cost per block fixed by
+// the number of voices playing and the algorithm, nothing else.
+
+const uint8_t FM_VOICES = 8;
+const uint8_t FM_OPERATORS = 4;
+const uint8_t FM_ALGORITHMS = 8;
+const uint8_t FM_OFF = 255;
+
+// Modulator bits for each operator, the carriers, and the operators in use.
+// Operators only take modulation from higher numbered ones, so rendering
+// 3, 2, 1, 0 always has the modulators ready.
+struct FmAlgorithm {
+  uint8_t modulators[FM_OPERATORS];
+  uint8_t carriers;
+  uint8_t used;
+};
+
+const FmAlgorithm FM_ALGORITHM[FM_ALGORITHMS] = {
+  {{0x2, 0x4, 0x8, 0}, 0x1, 0xF},  // 3 > 2 > 1 > 0
+  {{0x2, 0xC, 0, 0}, 0x1, 0xF},    // (3 + 2) > 1 > 0
+  {{0x6, 0, 0x8, 0}, 0x1, 0xF},    // (1 + (3 > 2)) > 0
+  {{0x2, 0, 0x8, 0}, 0x5, 0xF},    // 1 > 0, 3 > 2
+  {{0x8, 0x8, 0x8, 0}, 0x7, 0xF},  // 3 > (0, 1, 2)
+  {{0, 0, 0x8, 0}, 0x7, 0xF},      // 3 > 2, 1, 0
+  {{0, 0, 0, 0}, 0xF, 0xF},        // four sines, additive
+  {{0x2, 0, 0, 0}, 0x1, 0x3}       // 1 > 0, classic two operator
+};
+
+struct FmStats {
+  uint32_t cyclesPerBlock;  // cycles on the Teensy, nanoseconds on the host
+  uint32_t cyclesPerVoice;
+};
+
+class FmCore {
+  public:
+    FmCore(float sampleRate);
+
+    void algorithm(uint8_t voice, uint8_t algorithm);
+    void ratio(uint8_t voice, uint8_t op, float ratio);
+    void level(uint8_t voice, uint8_t op, float level);
+    void feedback(uint8_t voice, float amount);
+    void envelope(uint8_t voice, uint8_t op, float attackMs, float decayMs, float sustain, float releaseMs);
+    void frequency(uint8_t voice, float hz);
+
+    void noteOn(uint8_t voice);
+    void noteOff(uint8_t voice);
+    bool enabled(uint8_t voice) { return voice < FM_VOICES && _voice[voice].algorithm != FM_OFF; }
+
+    // Renders every enabled voice whose out pointer is not NULL
+    void process(int16_t **out, uint16_t count);
+
+  private:
+    enum { STAGE_IDLE = 0, STAGE_ATTACK, STAGE_DECAY, STAGE_RELEASE };
+
+    struct Operator {
+      uint32_t phase;
+      uint32_t increment;
+      uint32_t ratioQ16;
+      int32_t levelQ15;
+      // Envelope, Q30 and per block
+      uint8_t stage;
+      int32_t env;
+      int32_t target;
+      int32_t coef;
+      int32_t attackCoef;
+      int32_t decayCoef;
+      int32_t releaseCoef;
+      int32_t sustain;
+    };
+
+    struct Voice {
+      uint8_t algorithm = FM_OFF;
+      uint32_t baseIncrement = 0;
+      int32_t feedbackQ15 = 0;
+      int32_t lastOut = 0;
+      int32_t carrierScale = 8192;
+      Operator op[FM_OPERATORS];
+    };
+
+    int32_t blockCoefficient(float milliseconds, float ratio);
+    void envelopeStage(Operator &op, uint8_t stage);
+    void envelopeStep(Operator &op);
+
+    Voice _voice[FM_VOICES];
+    float _sampleRate;
+};
+
+FmCore::FmCore(float sampleRate) : _sampleRate(sampleRate) {
+  sineTableInit();
+  for (uint8_t v = 0; v < FM_VOICES; v++) {
+    for (uint8_t o = 0; o < FM_OPERATORS; o++) {
+      Operator &op = _voice[v].op[o];
+      memset(&op, 0, sizeof(op));
+      op.ratioQ16 = 1 << 16;
+      op.levelQ15 = (o == 0) ? 32767 : 8192;
+      envelope(v, o, 2, 300, 0.5, 300);
+    }
+  }
+}
+
+// Coefficient for one step per block, same overshoot idea as EnvelopeBank.h
+int32_t FmCore::blockCoefficient(float milliseconds, float ratio) {
+  float blocks = milliseconds * (_sampleRate / 1000.0f / 128.0f);
+  if (blocks < 1.0f) return 1 << 30;
+  return (1.0f - expf(-logf((1.0f + ratio) / ratio) / blocks)) * (1 << 30);
+}
+
+void FmCore::algorithm(uint8_t voice, uint8_t algorithm) {
+  if (voice >= FM_VOICES) return;
+  Voice &v = _voice[voice];
+  if (algorithm >= FM_ALGORITHMS) {
+    v.algorithm = FM_OFF;
+    return;
+  }
+  // Carriers share a quarter of full scale, about one oscillator through mixer1
+  uint8_t carriers = __builtin_popcount(FM_ALGORITHM[algorithm].carriers);
+  v.carrierScale = 8192 / carriers;
+  v.algorithm = algorithm;
+}
+
+void FmCore::ratio(uint8_t voice, uint8_t op, float ratio) {
+  if (voice >= FM_VOICES || op >= FM_OPERATORS) return;
+  Operator &o = _voice[voice].op[op];
+  o.ratioQ16 = ratio * 65536.0f;
+  o.increment = ((uint64_t)_voice[voice].baseIncrement * o.ratioQ16) >> 16;
+}
+
+// Output level for a carrier, modulation index for a modulator
+void FmCore::level(uint8_t voice, uint8_t op, float level) {
+  if (voice >= FM_VOICES || op >= FM_OPERATORS) return;
+  _voice[voice].op[op].levelQ15 = floatToQ15(level);
+}
+
+void FmCore::feedback(uint8_t voice, float amount) {
+  if (voice >= FM_VOICES) return;
+  _voice[voice].feedbackQ15 = floatToQ15(amount);
+}
+
+void FmCore::envelope(uint8_t voice, uint8_t op, float attackMs, float decayMs, float sustain, float releaseMs) {
+  if (voice >= FM_VOICES || op >= FM_OPERATORS) return;
+  Operator &o = _voice[voice].op[op];
+  o.attackCoef = blockCoefficient(attackMs, 0.3f);
+  o.decayCoef = blockCoefficient(decayMs, 0.01f);
+  o.releaseCoef = blockCoefficient(releaseMs, 0.01f);
+  o.sustain = floatToQ15(sustain) << 15;
+}
+
+void FmCore::frequency(uint8_t voice, float hz) {
+  if (voice >= FM_VOICES) return;
+  Voice &v = _voice[voice];
+  v.baseIncrement = hz * (4294967296.0f / _sampleRate);
+  for (uint8_t o = 0; o < FM_OPERATORS; o++) {
+    v.op[o].increment = ((uint64_t)v.baseIncrement * v.op[o].ratioQ16) >> 16;
+  }
+}
+
+void FmCore::envelopeStage(Operator &op, uint8_t stage) {
+  op.stage = stage;
+  switch (stage) {
+    case STAGE_ATTACK:
+      op.target = (1 << 30) + (int32_t)(0.3f * (1 << 30));
+      op.coef = op.attackCoef;
+      break;
+    case STAGE_DECAY:
+      op.target = op.sustain - (int32_t)(0.01f * (1 << 30));
+      op.coef = op.decayCoef;
+      break;
+    case STAGE_RELEASE:
+      op.target = -(int32_t)(0.01f * (1 << 30));
+      op.coef = op.releaseCoef;
+      break;
+    default:
+      op.env = 0;
+      op.target = 0;
+      op.coef = 0;
+      break;
+  }
+}
+
+void FmCore::envelopeStep(Operator &op) {
+  op.env += ((int64_t)(op.target - op.env) * op.coef) >> 30;
+  if (op.stage == STAGE_ATTACK && op.env >= (1 << 30)) {
+    op.env = 1 << 30;
+    envelopeStage(op, STAGE_DECAY);
+  } else if (op.stage == STAGE_DECAY && op.env <= op.sustain) {
+    op.env = op.sustain;
+    op.target = op.sustain; // hold here, follows sustain changes smoothly
+  } else if (op.stage == STAGE_RELEASE && op.env <= 0) {
+    envelopeStage(op, STAGE_IDLE);
+  }
+}
+
+void FmCore::noteOn(uint8_t voice) {
+  if (voice >= FM_VOICES) return;
+  for (uint8_t o = 0; o < FM_OPERATORS; o++) envelopeStage(_voice[voice].op[o], STAGE_ATTACK);
+}
+
+void FmCore::noteOff(uint8_t voice) {
+  if (voice >= FM_VOICES) return;
+  for (uint8_t o = 0; o < FM_OPERATORS; o++) {
+    if (_voice[voice].op[o].stage != STAGE_IDLE) envelopeStage(_voice[voice].op[o], STAGE_RELEASE);
+  }
+}
+
+void FmCore::process(int16_t **out, uint16_t count) {
+  for (uint8_t v = 0; v < FM_VOICES; v++) {
+    Voice &voice = _voice[v];
+    if (!out[v] || voice.algorithm == FM_OFF) continue;
+    const FmAlgorithm &algo = FM_ALGORITHM[voice.algorithm];
+
+    // Operator gains ramp from last block's envelope to this block's
+    int32_t gain[FM_OPERATORS];
+    int32_t step[FM_OPERATORS];
+    for (uint8_t o = 0; o < FM_OPERATORS; o++) {
+      Operator &op = voice.op[o];
+      int32_t from = mulQ15(op.env >> 15, op.levelQ15) << 15;
+      envelopeStep(op);
+      int32_t to = mulQ15(op.env >> 15, op.levelQ15) << 15;
+      gain[o] = from;
+      step[o] = (to - from) / (int32_t)count;
+    }
+
+    int16_t *dest = out[v];
+    int32_t lastOut = voice.lastOut;
+    for (uint16_t n = 0; n < count; n++) {
+      int32_t opOut[FM_OPERATORS];
+      int32_t mix = 0;
+      for (int8_t o = FM_OPERATORS - 1; o >= 0; o--) {
+        if (!(algo.used & (1 << o))) {
+          opOut[o] = 0;
+          continue;
+        }
+        Operator &op = voice.op[o];
+        uint8_t mods = algo.modulators[o];
+        int32_t pm = 0;
+        if (mods & 0x2) pm += opOut[1];
+        if (mods & 0x4) pm += opOut[2];
+        if (mods & 0x8) pm += opOut[3];
+        if (o == 3) pm += mulQ15(lastOut, voice.feedbackQ15);
+
+        op.phase += op.increment;
+        gain[o] += step[o];
+        // Full scale modulation swings the phase by two cycles
+        int32_t s = sineQ15(op.phase + ((uint32_t)pm << 18));
+        opOut[o] = (s * (gain[o] >> 15)) >> 15;
+        if (algo.carriers & (1 << o)) mix += opOut[o];
+      }
+      lastOut = opOut[3];
+      dest[n] = saturate16(mulQ15(mix, voice.carrierScale));
+    }
+    voice.lastOut = lastOut;
+  }
+}
+
+// Render blocks with every voice of a core of its own playing and report the
+// cost, so it can run next to the audio bank without touching its voices.
+FmStats fmMeasure(uint8_t algorithm, uint16_t blocks, float sampleRate) {
+  static int16_t buffer[FM_VOICES][128];
+  int16_t *out[FM_VOICES];
+  FmCore fm(sampleRate);
+  FmStats stats = {0, 0};
+
+  for (uint8_t v = 0; v < FM_VOICES; v++) {
+    out[v] = buffer[v];
+    fm.algorithm(v, algorithm);
+    fm.frequency(v, 110.0f * (v + 1));
+    fm.noteOn(v);
+  }
+
+  uint32_t cycles = 0;
+  for (uint16_t b = 0; b < blocks; b++) {
+    uint32_t start = cycleCount();
+    fm.process(out, 128);
+    cycles += cycleCount() - start;
+  }
+
+  stats.cyclesPerBlock = cycles / blocks;
+  stats.cyclesPerVoice = stats.cyclesPerBlock / FM_VOICES;
+  return stats;
+}
+
+#if defined(ARDUINO)
+#include <Audio.h>
+
+// One input and one output per voice. A voice with FM off passes its input
+// straight through; with FM on the operators replace it.
+class AudioSynthFmBank : public AudioStream {
+  public:
+    AudioSynthFmBank() : AudioStream(FM_VOICES, inputQueueArray), _fm(AUDIO_SAMPLE_RATE_EXACT) {}
+    virtual void update(void);
+
+    void algorithm(uint8_t voice, uint8_t algorithm) {
+      __disable_irq();
+      _fm.algorithm(voice, algorithm);
+      __enable_irq();
+    }
+    void ratio(uint8_t voice, uint8_t op, float ratio) { _fm.ratio(voice, op, ratio); }
+    void level(uint8_t voice, uint8_t op, float level) { _fm.level(voice, op, level); }
+    void feedback(uint8_t voice, float amount) { _fm.feedback(voice, amount); }
+    void envelope(uint8_t voice, uint8_t op, float attackMs, float decayMs, float sustain, float releaseMs) {
+      __disable_irq();
+      _fm.envelope(voice, op, attackMs, decayMs, sustain, releaseMs);
+      __enable_irq();
+    }
+    void frequency(uint8_t voice, float hz) {
+      __disable_irq();
+      _fm.frequency(voice, hz);
+      __enable_irq();
+    }
+    void noteOn(uint8_t voice) {
+      __disable_irq();
+      _fm.noteOn(voice);
+      __enable_irq();
+    }
+    void noteOff(uint8_t voice) {
+      __disable_irq();
+      _fm.noteOff(voice);
+      __enable_irq();
+    }
+
+    uint32_t cyclesPerBlock() { return _cycles; }
+    uint32_t cyclesPerBlockMax() { return _cyclesMax; }
+    void cyclesPerBlockMaxReset() { _cyclesMax = 0; }
+    FmCore &core() { return _fm; }
+
+  private:
+    audio_block_t *inputQueueArray[FM_VOICES];
+    FmCore _fm;
+    volatile uint32_t _cycles = 0;
+    volatile uint32_t _cyclesMax = 0;
+};
+
+void AudioSynthFmBank::update(void) {
+  audio_block_t *block[FM_VOICES];
+  int16_t *out[FM_VOICES];
+
+  for (uint8_t v = 0; v < FM_VOICES; v++) {
+    out[v] = NULL;
+    if (!_fm.enabled(v)) {
+      block[v] = receiveReadOnly(v);
+      continue;
+    }
+    block[v] = receiveWritable(v);
+    if (!block[v]) block[v] = allocate();
+    if (block[v]) out[v] = block[v]->data;
+  }
+
+  uint32_t start = cycleCount();
+  _fm.process(out, AUDIO_BLOCK_SAMPLES);
+  _cycles = cycleCount() - start;
+  if (_cycles > _cyclesMax) _cyclesMax = _cycles;
+
+  for (uint8_t v = 0; v < FM_VOICES; v++) {
+    if (!block[v]) continue;
+    transmit(block[v], v);
+    release(block[v]);
+  }
+}
+#endif
+
+#endif
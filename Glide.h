@@ -0,0 +1,112 @@
+#ifndef GLIDE_H__
+#define GLIDE_H__
+
+#include <Audio.h>
+
+// Portamento in the pitch domain.
+//
+// Pitch is kept in cents (with an 8 bit fraction) from MIDI note 0, so a
+// glide is a straight line and sounds even across the keyboard. step() is
+// called once per audio block from an AudioControlClock listener and moves
+// the pitch by a fixed amount; the oscillators are only retuned while a
+// glide is actually moving.
+//
+// centsToHz() turns a pitch into a frequency with a 129 entry table across
+// one octave and linear interpolation (better than 0.01 cent), instead of a
+// pow() per oscillator.
+
+const float PITCH_BASE_HZ = 8.1757989;  // MIDI note 0
+const float OCTAVE_TABLE[129] = {
+  1, 1.00543, 1.010889, 1.016378, 1.021897, 1.027446, 1.033025, 1.038634, 1.044274, 1.049944,
+  1.055645, 1.061377, 1.06714, 1.072935, 1.078761, 1.084618, 1.090508, 1.096429, 1.102383, 1.108368,
+  1.114387, 1.120438, 1.126522, 1.132639, 1.138789, 1.144972, 1.151189, 1.15744, 1.163725, 1.170044,
+  1.176397, 1.182785, 1.189207, 1.195664, 1.202157, 1.208684, 1.215247, 1.221846, 1.228481, 1.235151,
+  1.241858, 1.248601, 1.255381, 1.262197, 1.269051, 1.275942, 1.28287, 1.289836, 1.29684, 1.303881,
+  1.310961, 1.31808, 1.325237, 1.332433, 1.339668, 1.346942, 1.354256, 1.361609, 1.369002, 1.376436,
+  1.38391, 1.391424, 1.39898, 1.406576, 1.414214, 1.421893, 1.429613, 1.437376, 1.445181, 1.453028,
+  1.460918, 1.46885, 1.476826, 1.484845, 1.492908, 1.501014, 1.509164, 1.517359, 1.525598, 1.533882,
+  1.542211, 1.550585, 1.559004, 1.56747, 1.575981, 1.584538, 1.593142, 1.601793, 1.61049, 1.619235,
+  1.628027, 1.636867, 1.645755, 1.654692, 1.663677, 1.67271, 1.681793, 1.690925, 1.700106, 1.709338,
+  1.718619, 1.727951, 1.737334, 1.746767, 1.756252, 1.765788, 1.775376, 1.785017, 1.794709, 1.804454,
+  1.814252, 1.824103, 1.834008, 1.843967, 1.853979, 1.864046, 1.874168, 1.884344, 1.894576, 1.904863,
+  1.915207, 1.925606, 1.936062, 1.946574, 1.957144, 1.967771, 1.978456, 1.989199, 2
+};
+
+enum GlideMode {
+  GLIDE_OFF = 0,
+  GLIDE_TIME,      // every glide takes the same time
+  GLIDE_RATE       // the same time per octave
+};
+
+float centsToHz(int32_t cents) {
+  if (cents < 0) cents = 0;
+  uint32_t octave = cents / 1200;
+  uint32_t x = ((cents - octave * 1200) << 16) / 1200;
+  uint32_t index = x >> 9;
+  float frac = (x & 511) * (1.0f / 512.0f);
+  float ratio = OCTAVE_TABLE[index] + (OCTAVE_TABLE[index + 1] - OCTAVE_TABLE[index]) * frac;
+  return PITCH_BASE_HZ * (float)(1UL << octave) * ratio;
+}
+
+class Glide {
+  public:
+    void mode(GlideMode mode, bool legatoOnly) {
+      _mode = mode;
+      _legatoOnly = legatoOnly;
+    }
+
+    // Glide time in GLIDE_TIME, time per octave in GLIDE_RATE
+    void time(float milliseconds) {
+      _blocks = milliseconds * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f) / AUDIO_BLOCK_SAMPLES;
+    }
+
+    void target(int32_t cents, bool connected);
+    void step();
+    bool moving() { return _blocksLeft != 0; }
+    int32_t cents() { return _pitchQ8 >> 8; }
+
+  private:
+    GlideMode _mode = GLIDE_OFF;
+    bool _legatoOnly = false;
+    uint32_t _blocks = 0;
+    volatile int32_t _pitchQ8 = 6000 << 8;
+    int32_t _targetQ8 = 6000 << 8;
+    int32_t _stepQ8 = 0;
+    volatile uint32_t _blocksLeft = 0;
+};
+
+// New note. connected is true when it follows a note that is still held;
+// legato only glides ignore the rest.
+void Glide::target(int32_t cents, bool connected) {
+  _targetQ8 = cents << 8;
+  if (_mode == GLIDE_OFF || _blocks == 0 || (_legatoOnly && !connected)) {
+    _pitchQ8 = _targetQ8;
+    _blocksLeft = 0;
+    return;
+  }
+
+  int32_t distance = _targetQ8 - _pitchQ8;
+  uint32_t blocks = _blocks;
+  if (_mode == GLIDE_RATE) {
+    uint32_t perBlock = (1200 << 8) / _blocks;
+    if (perBlock == 0) perBlock = 1;
+    blocks = (uint32_t)abs(distance) / perBlock;
+  }
+  if (blocks == 0) {
+    _pitchQ8 = _targetQ8;
+    _blocksLeft = 0;
+    return;
+  }
+  _stepQ8 = distance / (int32_t)blocks;
+  _blocksLeft = blocks;
+}
+
+// Audio interrupt, once per block
+void Glide::step() {
+  if (_blocksLeft == 0) return;
+  _blocksLeft = _blocksLeft - 1;
+  if (_blocksLeft == 0) _pitchQ8 = _targetQ8;
+  else _pitchQ8 = _pitchQ8 + _stepQ8;
+}
+
+#endif
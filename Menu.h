@@ -23,21 +23,72 @@
 #include <font_ArialBold.h>
 #include "SynthLib.h"
 #include <Encoder.h>
+#include <TeensyThreads.h>
+#include "TouchInput.h"
 
+void mainMenuChoices(void);
 void commandGetAnInteger(void);
 void commandGetAFloat(void);
 void oscillatorOneChoices(void);
 void oscillatorTwoChoices(void);
 void ampADSRChoices(void);
 void mixerChoices(void);
+void messageShow(void);
+byte mainMenuTouch(void);
+byte commandGetAnIntegerTouch(void);
+byte commandGetAFloatTouch(void);
+byte oscillatorOneTouch(void);
+byte oscillatorTwoTouch(void);
+byte ampADSRTouch(void);
+byte mixerTouch(void);
+byte messageTouch(void);
 void enableSelfDestructCallback(void);
 //
 // create the user interface object
 //
 TeensyUserInterface ui;
+TouchInput touch;
 Encoder mainEncoder(4, 5);
 int encoderCC = CCmixer1;
 
+//
+// the menu is a state machine: each page has a function that draws it and one that
+// handles a touch event and returns the page to show next, which menuLoop() calls
+// only when the touch queue or the encoder has something, so an idle menu costs
+// the other threads almost nothing
+//
+enum MenuPage {PAGE_MAIN, PAGE_INTEGER, PAGE_FLOAT, PAGE_OSC1, PAGE_OSC2, PAGE_ADSR, PAGE_MIXER, PAGE_MESSAGE, MENU_PAGES};
+
+void (*const pageDraw[MENU_PAGES])(void) = {
+  mainMenuChoices, commandGetAnInteger, commandGetAFloat, oscillatorOneChoices,
+  oscillatorTwoChoices, ampADSRChoices, mixerChoices, messageShow
+};
+byte (*const pageTouch[MENU_PAGES])(void) = {
+  mainMenuTouch, commandGetAnIntegerTouch, commandGetAFloatTouch, oscillatorOneTouch,
+  oscillatorTwoTouch, ampADSRTouch, mixerTouch, messageTouch
+};
+
+const uint32_t MENU_REPEAT_DELAY = 500;    // ms a finger is held before number boxes start stepping
+const uint32_t MENU_REPEAT_PERIOD = 100;   // ms between steps after that
+const uint32_t MENU_MESSAGE_TIME = 1500;   // ms
+
+byte menuPage = PAGE_MAIN;
+uint32_t menuWakeAt = 0;                   // millis() for a page timeout, 0 for none
+volatile bool menuEncoderMoved = false;
+volatile byte menuEncoderValue = 0;
+volatile uint32_t menuBusyMicros = 0;      // only ever grows, menuReport() takes differences
+
+//
+// number boxes on the current page that follow the encoder when it is on their CC
+//
+const byte MENU_BOUND_BOXES = 4;
+struct MenuBoundBox {
+  NUMBER_BOX *box;
+  byte control;
+};
+MenuBoundBox menuBound[MENU_BOUND_BOXES];
+byte menuBoundCount = 0;
+
 // ---------------------------------------------------------------------------------
 //                                 Setup the hardware
 // ---------------------------------------------------------------------------------
@@ -55,6 +106,11 @@ void menuSetup()
   // use a grayscale color palette
   //
   ui.setColorPaletteGray();
+
+  //
+  // the touch controller is read by TouchInput, only when its INT line says there is a touch
+  //
+  touch.begin();
 }
 
 
@@ -100,6 +156,7 @@ MENU_ITEM mainMenu[] = {
 int previousEncoderValue = 0;
 
 void handleMainEncoder() {
+  ProfileScope scope(profiler, PROFILE_ENCODER);
   long currentEncoderValue = mainEncoder.read();
 
   if (previousEncoderValue != currentEncoderValue) {
@@ -107,18 +164,155 @@ void handleMainEncoder() {
     if (modulus == 0)
     {
       setControlChange(encoderCC, currentEncoderValue*4);
+      menuEncoderValue = currentEncoderValue*4;
+      menuEncoderMoved = true;
     }
   }
   previousEncoderValue = currentEncoderValue;
   
 }
 
+//
+// show a page, dropping whatever the previous one had bound to the encoder
+//
+void menuShow(byte page)
+{
+  menuPage = page;
+  menuWakeAt = 0;
+  menuBoundCount = 0;
+  ProfileScope scope(profiler, PROFILE_MENU);
+  pageDraw[page]();
+}
+
+void menuBind(NUMBER_BOX &box, byte control)
+{
+  if (menuBoundCount < MENU_BOUND_BOXES)
+    menuBound[menuBoundCount++] = {&box, control};
+}
+
+//
+// the encoder moved: redraw the bound number box it is changing, if it is on this page
+//
+void menuEncoder(byte value)
+{
+  for (byte i = 0; i < menuBoundCount; i++)
+  {
+    if (menuBound[i].control != encoderCC) continue;
+    NUMBER_BOX &box = *menuBound[i].box;
+    box.value = constrain((int)value, box.minimumValue, box.maximumValue);
+    ProfileScope scope(profiler, PROFILE_MENU);
+    ui.drawNumberBox(box);
+  }
+}
+
+//
+// hand a touch to the current page the way the library's getTouchEvents() would have
+//
+void menuTouch(int eventType, int x, int y)
+{
+  ui.touchEventType = eventType;
+  ui.touchEventX = x;
+  ui.touchEventY = y;
+  byte next;
+  {
+    ProfileScope scope(profiler, PROFILE_MENU);
+    next = pageTouch[menuPage]();
+  }
+  if (next != menuPage) menuShow(next);
+}
+
 //
 // display the menu, then execute commands selected by the user
 //
+// Touches come from the TouchInput queue, which only reads the controller after its
+// interrupt or while a finger is down. Down and up become the library's pushed and
+// released events, and a held finger gives repeat events, which number boxes step on.
+// The rest of the time the thread just yields, and the time spent handling events is
+// added up in menuBusyMicros.
+//
 void menuLoop() 
 {  
-  ui.displayAndExecuteMenu(mainMenu);
+  TouchEvent event;
+  int touchX = 0;
+  int touchY = 0;
+  uint32_t repeatAt = 0;
+
+  spiBus.lock();
+  menuShow(PAGE_MAIN);
+  spiBus.unlock();
+  while (true)
+  {
+    bool repeat = touch.touching() && (int32_t)(millis() - repeatAt) >= 0;
+    bool timeout = menuWakeAt && (int32_t)(millis() - menuWakeAt) >= 0;
+    if (!touch.pending() && !repeat && !menuEncoderMoved && !timeout)
+    {
+      threads.yield();
+      continue;
+    }
+
+    uint32_t start = micros();
+    touch.service();
+    spiBus.lock();  // the TFT shares the SPI bus with the flash chip
+    while (touch.read(event))
+    {
+      touchX = event.x;
+      touchY = event.y;
+      if (event.type == TOUCH_DOWN)
+      {
+        repeatAt = millis() + MENU_REPEAT_DELAY;
+        repeat = false;
+        menuTouch(TOUCH_PUSHED_EVENT, touchX, touchY);
+      }
+      else if (event.type == TOUCH_UP)
+      {
+        repeat = false;
+        menuTouch(TOUCH_RELEASED_EVENT, touchX, touchY);
+      }
+    }
+    if (repeat)
+    {
+      repeatAt += MENU_REPEAT_PERIOD;
+      menuTouch(TOUCH_REPEAT_EVENT, touchX, touchY);
+    }
+    if (menuEncoderMoved)
+    {
+      menuEncoderMoved = false;
+      menuEncoder(menuEncoderValue);
+    }
+    if (timeout) menuShow(PAGE_MAIN);
+    spiBus.unlock();
+    menuBusyMicros += micros() - start;
+  }
+}
+
+//
+// print how much of the time since the last report the menu thread was busy
+//
+void menuReport(Print &out)
+{
+  static uint32_t lastBusy = 0;
+  static uint32_t lastReport = 0;
+  uint32_t now = micros();
+  uint32_t busy = menuBusyMicros - lastBusy;
+  uint32_t elapsed = now - lastReport;
+  lastBusy += busy;
+  lastReport = now;
+  out.printf("menu busy %lu us of %lu ms, idle %lu%%\n", busy, elapsed / 1000,
+             elapsed ? 100 - (uint32_t)((uint64_t)busy * 100 / elapsed) : 100);
+}
+
+//
+// background thread that writes configuration changes to EEPROM, a record at a time,
+// and presets received over SysEx to flash
+//
+void configLoop()
+{
+  while (true)
+  {
+    config.poll();
+    sysex.work();
+    threads.delay(10);
+  }
 }
 
 void setControlChange(byte controlChange, byte value){
@@ -131,21 +325,115 @@ void setControlChange(byte controlChange, byte value){
 //                            Commands executed from the menu
 // ---------------------------------------------------------------------------------
 
+//
+// the main menu, drawn from mainMenu[] as a grid of buttons
+//
+const byte MAIN_MENU_BUTTONS = 8;
+static BUTTON mainMenuButtons[MAIN_MENU_BUTTONS];
+static char mainMenuToggleText[MAIN_MENU_BUTTONS][32];
+static byte mainMenuButtonCount = 0;
+
+void mainMenuChoices(void)
+{
+  const int buttonHeight = 34;
+  const int buttonSpacing = 44;
+  const byte columns = mainMenu[0].MenuItemFunction == MENU_COLUMNS_2 ? 2 : 1;
+  const int buttonWidth = (ui.displaySpaceWidth - 30) / columns;
+
+  ui.drawTitleBar(mainMenu[0].MenuItemText);
+  ui.clearDisplaySpace();
+
+  mainMenuButtonCount = 0;
+  for (byte i = 1; mainMenu[i].MenuItemType != MENU_ITEM_TYPE_END_OF_MENU && mainMenuButtonCount < MAIN_MENU_BUTTONS; i++)
+  {
+    byte b = mainMenuButtonCount++;
+    BUTTON &button = mainMenuButtons[b];
+    button.labelText = mainMenu[i].MenuItemText;
+    button.centerX = ui.displaySpaceLeftX + 10 + buttonWidth / 2 + (b % columns) * (buttonWidth + 10);
+    button.centerY = ui.displaySpaceTopY + 30 + (b / columns) * buttonSpacing;
+    button.width = buttonWidth;
+    button.height = buttonHeight;
+
+    //
+    // a toggle shows its current state, which its callback reports without changing it
+    //
+    if (mainMenu[i].MenuItemType == MENU_ITEM_TYPE_TOGGLE)
+    {
+      ui.toggleSelectNextStateFlg = false;
+      mainMenu[i].MenuItemFunction();
+      sprintf(mainMenuToggleText[b], "%s: %s", mainMenu[i].MenuItemText, ui.toggleText);
+      button.labelText = mainMenuToggleText[b];
+    }
+    ui.drawButton(button);
+  }
+}
+
+byte mainMenuTouch(void)
+{
+  for (byte b = 0; b < mainMenuButtonCount; b++)
+  {
+    if (!ui.checkForButtonClicked(mainMenuButtons[b]))
+      continue;
+
+    MENU_ITEM &item = mainMenu[b + 1];
+    if (item.MenuItemType == MENU_ITEM_TYPE_TOGGLE)
+    {
+      ui.toggleSelectNextStateFlg = true;
+      item.MenuItemFunction();
+      sprintf(mainMenuToggleText[b], "%s: %s", item.MenuItemText, ui.toggleText);
+      ui.drawButton(mainMenuButtons[b]);
+      return PAGE_MAIN;
+    }
+
+    //
+    // a command opens the page it draws
+    //
+    for (byte page = 0; page < MENU_PAGES; page++)
+    {
+      if (pageDraw[page] == item.MenuItemFunction)
+        return page;
+    }
+  }
+  return PAGE_MAIN;
+}
+
+
+//
+// a line of text in the middle of the screen, back to the main menu after MENU_MESSAGE_TIME
+//
+static char messageText[32];
+
+void messageShow(void)
+{
+  ui.clearDisplaySpace();
+  ui.lcdSetCursorXY(ui.displaySpaceCenterX, ui.displaySpaceCenterY-10);
+  ui.lcdPrintCentered(messageText);
+  menuWakeAt = millis() + MENU_MESSAGE_TIME;
+  if (!menuWakeAt) menuWakeAt = 1;
+}
+
+byte messageTouch(void)
+{
+  return PAGE_MESSAGE;
+}
+
+
 //
 // menu command that demonstrates how to prompt the user for an integer
 //
 static int xOffsetValue = 50;
+static NUMBER_BOX xOffset_NumberBox;
+static BUTTON xOffsetOkButton;
+static BUTTON xOffsetCancelButton;
 
 void commandGetAnInteger(void)
 {
-  char sBuffer[25];
-  
   //
   // draw the title bar and clear the screen
   //
   ui.drawTitleBar("Prompt User for an Integer");
   ui.clearDisplaySpace();
-  
+
   //
   // set the size and initial value of the number box
   //
@@ -153,68 +441,61 @@ void commandGetAnInteger(void)
   const int numberBoxAndButtonsHeight = 35;
 
   //
-  // define a Number Box so the user can select a numeric value, specify the initial value, 
+  // define a Number Box so the user can select a numeric value, specify the initial value,
   // max and min values, and step up/down amount
   //
-  NUMBER_BOX my_NumberBox;
-  my_NumberBox.labelText     = "Set X offset";
-  my_NumberBox.value         = xOffsetValue;
-  my_NumberBox.minimumValue  = -200;
-  my_NumberBox.maximumValue  = 200;
-  my_NumberBox.stepAmount    = 2;
-  my_NumberBox.centerX       = ui.displaySpaceCenterX;
-  my_NumberBox.centerY       = ui.displaySpaceCenterY - 20;
-  my_NumberBox.width         = numberBoxWidth;
-  my_NumberBox.height        = numberBoxAndButtonsHeight;
-  ui.drawNumberBox(my_NumberBox);
+  xOffset_NumberBox.labelText     = "Set X offset";
+  xOffset_NumberBox.value         = xOffsetValue;
+  xOffset_NumberBox.minimumValue  = -200;
+  xOffset_NumberBox.maximumValue  = 200;
+  xOffset_NumberBox.stepAmount    = 2;
+  xOffset_NumberBox.centerX       = ui.displaySpaceCenterX;
+  xOffset_NumberBox.centerY       = ui.displaySpaceCenterY - 20;
+  xOffset_NumberBox.width         = numberBoxWidth;
+  xOffset_NumberBox.height        = numberBoxAndButtonsHeight;
+  ui.drawNumberBox(xOffset_NumberBox);
 
 
   //
   // define and display "OK" and "Cancel" buttons
   //
-  BUTTON okButton        = {"OK",      ui.displaySpaceCenterX-70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
-  ui.drawButton(okButton);
+  xOffsetOkButton        = {"OK",      ui.displaySpaceCenterX-70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
+  ui.drawButton(xOffsetOkButton);
 
-  BUTTON cancelButton    = {"Cancel",  ui.displaySpaceCenterX+70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
-  ui.drawButton(cancelButton);
+  xOffsetCancelButton    = {"Cancel",  ui.displaySpaceCenterX+70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
+  ui.drawButton(xOffsetCancelButton);
+}
 
+//
+// process a touch event
+//
+byte commandGetAnIntegerTouch(void)
+{
+  //
+  // process touch events on the Number Box
+  //
+  ui.checkForNumberBoxTouched(xOffset_NumberBox);
 
   //
-  // process touch events
+  // check for touch events on the "OK" button
   //
-  while(true)
+  if (ui.checkForButtonClicked(xOffsetOkButton))
   {
-    ui.getTouchEvents();
-
-    //
-    // process touch events on the Number Box
-    //
-    ui.checkForNumberBoxTouched(my_NumberBox);
- 
     //
-    // check for touch events on the "OK" button
+    // user OK pressed, get the value from the Number Box and display it
     //
-    if (ui.checkForButtonClicked(okButton))
-    {
-      //
-      // user OK pressed, get the value from the Number Box and display it
-      //
-      xOffsetValue = my_NumberBox.value;
-      sprintf(sBuffer, "X Offset = %d", xOffsetValue);
-
-      ui.clearDisplaySpace();      
-      ui.lcdSetCursorXY(ui.displaySpaceCenterX, ui.displaySpaceCenterY-10);
-      ui.lcdPrintCentered(sBuffer);
-      delay(1500);
-      return;
-    }
-
-    //
-    // check for touch events on the "Cancel" button
-    //
-    if (ui.checkForButtonClicked(cancelButton))
-      return;
+    xOffsetValue = xOffset_NumberBox.value;
+    sprintf(messageText, "X Offset = %d", xOffsetValue);
+    return PAGE_MESSAGE;
   }
+
+  //
+  // check for touch events on the "Cancel" button
+  //
+  if (ui.checkForButtonClicked(xOffsetCancelButton))
+    return PAGE_MAIN;
+
+  return PAGE_INTEGER;
 }
 
 
@@ -223,17 +504,18 @@ void commandGetAnInteger(void)
 // menu command that demonstrates how to prompt the user for an float
 //
 static float xScalerValue = 0.57;
+static NUMBER_BOX_FLOAT xScaler_NumberBox;
+static BUTTON xScalerOkButton;
+static BUTTON xScalerCancelButton;
 
 void commandGetAFloat(void)
 {
-  char sBuffer[30];
-  
   //
   // draw the title bar and clear the screen
   //
   ui.drawTitleBar("Prompt User for an float");
   ui.clearDisplaySpace();
-  
+
   //
   // set the size and initial value of the number box
   //
@@ -241,69 +523,62 @@ void commandGetAFloat(void)
   const int numberBoxAndButtonsHeight = 35;
 
   //
-  // define a Number Box for Floats so the user can select a numeric value, specify 
+  // define a Number Box for Floats so the user can select a numeric value, specify
   // the initial value, max and min values, and step up/down amount
   //
-  NUMBER_BOX_FLOAT my_NumberBox;
-  my_NumberBox.labelText           = "Set X scaler";
-  my_NumberBox.value                = xScalerValue;
-  my_NumberBox.minimumValue         = 0.0;
-  my_NumberBox.maximumValue         = 1.0;
-  my_NumberBox.stepAmount           = 0.01;
-  my_NumberBox.digitsRightOfDecimal = 2;
-  my_NumberBox.centerX              = ui.displaySpaceCenterX;
-  my_NumberBox.centerY              = ui.displaySpaceCenterY - 20;;
-  my_NumberBox.width                = numberBoxWidth;
-  my_NumberBox.height               = numberBoxAndButtonsHeight;
-  ui.drawNumberBox(my_NumberBox);
+  xScaler_NumberBox.labelText            = "Set X scaler";
+  xScaler_NumberBox.value                = xScalerValue;
+  xScaler_NumberBox.minimumValue         = 0.0;
+  xScaler_NumberBox.maximumValue         = 1.0;
+  xScaler_NumberBox.stepAmount           = 0.01;
+  xScaler_NumberBox.digitsRightOfDecimal = 2;
+  xScaler_NumberBox.centerX              = ui.displaySpaceCenterX;
+  xScaler_NumberBox.centerY              = ui.displaySpaceCenterY - 20;
+  xScaler_NumberBox.width                = numberBoxWidth;
+  xScaler_NumberBox.height               = numberBoxAndButtonsHeight;
+  ui.drawNumberBox(xScaler_NumberBox);
 
 
   //
   // define and display "OK" and "Cancel" buttons
   //
-  BUTTON okButton        = {"OK",      ui.displaySpaceCenterX-70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
-  ui.drawButton(okButton);
+  xScalerOkButton        = {"OK",      ui.displaySpaceCenterX-70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
+  ui.drawButton(xScalerOkButton);
 
-  BUTTON cancelButton    = {"Cancel",  ui.displaySpaceCenterX+70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
-  ui.drawButton(cancelButton);
+  xScalerCancelButton    = {"Cancel",  ui.displaySpaceCenterX+70, ui.displaySpaceBottomY-35,  120 , numberBoxAndButtonsHeight};
+  ui.drawButton(xScalerCancelButton);
+}
 
+//
+// process a touch event
+//
+byte commandGetAFloatTouch(void)
+{
+  //
+  // process touch events on the Number Box
+  //
+  ui.checkForNumberBoxTouched(xScaler_NumberBox);
 
   //
-  // process touch events
+  // check for touch events on the "OK" button
   //
-  while(true)
+  if (ui.checkForButtonClicked(xScalerOkButton))
   {
-    ui.getTouchEvents();
-
     //
-    // process touch events on the Number Box
+    // user OK pressed, get the value from the Number Box and display it
     //
-    ui.checkForNumberBoxTouched(my_NumberBox);
- 
-    //
-    // check for touch events on the "OK" button
-    //
-    if (ui.checkForButtonClicked(okButton))
-    {
-      //
-      // user OK pressed, get the value from the Number Box and display it
-      //
-      xScalerValue = my_NumberBox.value;
-      sprintf(sBuffer, "X Offset = %4.2f", xScalerValue);
-
-      ui.clearDisplaySpace();      
-      ui.lcdSetCursorXY(ui.displaySpaceCenterX, ui.displaySpaceCenterY-10);
-      ui.lcdPrintCentered(sBuffer);
-      delay(1500);
-      return;
-    }
-
-    //
-    // check for touch events on the "Cancel" button
-    //
-    if (ui.checkForButtonClicked(cancelButton))
-      return;
+    xScalerValue = xScaler_NumberBox.value;
+    sprintf(messageText, "X Offset = %4.2f", xScalerValue);
+    return PAGE_MESSAGE;
   }
+
+  //
+  // check for touch events on the "Cancel" button
+  //
+  if (ui.checkForButtonClicked(xScalerCancelButton))
+    return PAGE_MAIN;
+
+  return PAGE_FLOAT;
 }
 
 
@@ -313,18 +588,19 @@ void commandGetAFloat(void)
 //
 static int oscillatorOneSelection = 1;
 static int oscillatorTwoSelection = 1;
+static SELECTION_BOX oscillatorOneBox;
+static SELECTION_BOX oscillatorTwoBox;
 
 void oscillatorOneChoices(void)
-{  
+{
   ui.drawTitleBarWithBackButton("Oscillator One");
   ui.clearDisplaySpace();
 
   //
-  // define and display 3 selection boxes, one with 2 choice, one with 3 choice 
+  // define and display 3 selection boxes, one with 2 choice, one with 3 choice
   // and one with 4
   //
 
-  SELECTION_BOX oscillatorOneBox;
   oscillatorOneBox.labelText = "Oscillator 1";
   oscillatorOneBox.value = oscillatorOneSelection;
   oscillatorOneBox.choice0Text = "Sine";
@@ -336,44 +612,42 @@ void oscillatorOneChoices(void)
   oscillatorOneBox.width = 250;
   oscillatorOneBox.height = 33;
   ui.drawSelectionBox(oscillatorOneBox);
+}
 
+//
+// process a touch event
+//
+byte oscillatorOneTouch(void)
+{
   //
-  // process touch events
+  // process touch events in the selection boxes
   //
-  while(true)
-  {
-    ui.getTouchEvents();
-
-    //
-    // process touch events in the selection boxes
-    //
-    if (ui.checkForSelectionBoxTouched(oscillatorOneBox)) {
-      setControlChange(CCosc1,oscillatorOneBox.value);
-    }
+  if (ui.checkForSelectionBoxTouched(oscillatorOneBox)) {
+    setControlChange(CCosc1,oscillatorOneBox.value);
+  }
 
-    //
-    // when the "Back" button is pressed, save all the values selected
-    // by the user
-    //
-    if (ui.checkForBackButtonClicked())
-    {
-      oscillatorOneSelection = oscillatorOneBox.value;
-      return;
-    }
+  //
+  // when the "Back" button is pressed, save all the values selected
+  // by the user
+  //
+  if (ui.checkForBackButtonClicked())
+  {
+    oscillatorOneSelection = oscillatorOneBox.value;
+    return PAGE_MAIN;
   }
+  return PAGE_OSC1;
 }
 
 void oscillatorTwoChoices(void)
-{  
+{
   ui.drawTitleBarWithBackButton("Oscillator Two");
   ui.clearDisplaySpace();
 
   //
-  // define and display 3 selection boxes, one with 2 choice, one with 3 choice 
+  // define and display 3 selection boxes, one with 2 choice, one with 3 choice
   // and one with 4
   //
 
-  SELECTION_BOX oscillatorTwoBox;
   oscillatorTwoBox.labelText = "Oscillator 2";
   oscillatorTwoBox.value = oscillatorTwoSelection;
   oscillatorTwoBox.choice0Text = "Sine";
@@ -385,31 +659,30 @@ void oscillatorTwoChoices(void)
   oscillatorTwoBox.width = 250;
   oscillatorTwoBox.height = 33;
   ui.drawSelectionBox(oscillatorTwoBox);
-  
+}
+
+//
+// process a touch event
+//
+byte oscillatorTwoTouch(void)
+{
   //
-  // process touch events
+  // process touch events in the selection boxes
   //
-  while(true)
-  {
-    ui.getTouchEvents();
-
-    //
-    // process touch events in the selection boxes
-    //
-    if (ui.checkForSelectionBoxTouched(oscillatorTwoBox)) {
-      setControlChange(CCosc2,oscillatorTwoBox.value);
-    }
+  if (ui.checkForSelectionBoxTouched(oscillatorTwoBox)) {
+    setControlChange(CCosc2,oscillatorTwoBox.value);
+  }
 
-    //
-    // when the "Back" button is pressed, save all the values selected
-    // by the user
-    //
-    if (ui.checkForBackButtonClicked())
-    {
-      oscillatorTwoSelection = oscillatorTwoBox.value;
-      return;
-    }
+  //
+  // when the "Back" button is pressed, save all the values selected
+  // by the user
+  //
+  if (ui.checkForBackButtonClicked())
+  {
+    oscillatorTwoSelection = oscillatorTwoBox.value;
+    return PAGE_MAIN;
   }
+  return PAGE_OSC2;
 }
 
 //
@@ -456,7 +729,8 @@ void enableSelfDestructCallback(void)
 
 
 //
-// storage locations in EEPROM for configuration values settable below
+// storage locations in EEPROM for configuration values settable below, only read now
+// by configMigrate() for settings saved before ConfigStore.h
 //
 const int EEPROM_AMP_ATTACK = 0;                        // int requires 5 bytes of EEPROM storage
 const int EEPROM_AMP_DECAY = EEPROM_AMP_ATTACK + 5;      // int requires 5 bytes of EEPROM storage
@@ -467,6 +741,30 @@ const int EEPROM_MIXER_OSC2 = EEPROM_MIXER_OSC1 + 5;      // int requires 5 byte
 const int EEPROM_MIXER_NOISE = EEPROM_MIXER_OSC2 + 5;      // int requires 5 bytes of EEPROM storage
 const int EEPROM_MIXER_SUB = EEPROM_MIXER_NOISE + 5;      // int requires 5 bytes of EEPROM storage
 
+//
+// copy settings saved before ConfigStore.h into it, so bootRestore() and the pages below
+// see them. A key the store already has is left alone, so this only does anything on the
+// first boot after the update. Called from synthSetup(), before bootRestore()
+//
+void configMigrate()
+{
+  const int legacySlots[8] = {EEPROM_AMP_ATTACK, EEPROM_AMP_DECAY, EEPROM_AMP_SUSTAIN, EEPROM_AMP_RELEASE,
+                              EEPROM_MIXER_OSC1, EEPROM_MIXER_OSC2, EEPROM_MIXER_NOISE, EEPROM_MIXER_SUB};
+
+  for (byte key = CONFIG_AMP_ATTACK; key <= CONFIG_MIXER_SUB; key++)
+  {
+    if (config.has(key))
+      continue;
+
+    //
+    // -1 is never a saved value, so it means the slot was never written
+    //
+    int value = ui.readConfigurationInt(legacySlots[key], -1);
+    if (value >= 0 && value <= 127)
+      config.set(key, value);
+  }
+}
+
 //
 // defaults for configuration values, these values are used if they have never been set before
 //
@@ -483,6 +781,12 @@ const int   DEFAULT_MIXER_SUB   = 127;
 //
 // menu command that demonstrates how to prompt the user for info then save it
 //
+static NUMBER_BOX mixerOsc1_NumberBox;
+static NUMBER_BOX mixerOsc2_NumberBox;
+static NUMBER_BOX mixerNoise_NumberBox;
+static NUMBER_BOX mixerSub_NumberBox;
+static BUTTON mixerOkButton;
+
 void mixerChoices(void)
 {
   const int numberBoxWidth = 145;
@@ -490,12 +794,12 @@ void mixerChoices(void)
 
 
   //
-  // read initial values from the EEPROM, if the EEPROM has never been set, use default values
+  // read initial values from the config store, or the defaults if they have never been saved
   //
-  int initialMixerOsc1 = ui.readConfigurationInt(EEPROM_MIXER_OSC1, DEFAULT_MIXER_OSC1);;
-  int initialMixerOsc2 = ui.readConfigurationInt(EEPROM_MIXER_OSC2, DEFAULT_MIXER_OSC2);
-  int initialMixerNoise = ui.readConfigurationInt(EEPROM_MIXER_NOISE, DEFAULT_MIXER_NOISE);
-  int initialMixerSub = ui.readConfigurationInt(EEPROM_MIXER_SUB, DEFAULT_MIXER_SUB);
+  int initialMixerOsc1 = config.get(CONFIG_MIXER_OSC1, DEFAULT_MIXER_OSC1);
+  int initialMixerOsc2 = config.get(CONFIG_MIXER_OSC2, DEFAULT_MIXER_OSC2);
+  int initialMixerNoise = config.get(CONFIG_MIXER_NOISE, DEFAULT_MIXER_NOISE);
+  int initialMixerSub = config.get(CONFIG_MIXER_SUB, DEFAULT_MIXER_SUB);
 
 
   //
@@ -508,7 +812,6 @@ void mixerChoices(void)
   //
   // define and display number boxes for setting calibration constants
   //
-  NUMBER_BOX mixerOsc1_NumberBox;
   mixerOsc1_NumberBox.labelText    = "Oscillator 1";
   mixerOsc1_NumberBox.value        = initialMixerOsc1;
   mixerOsc1_NumberBox.minimumValue = 0;
@@ -520,7 +823,6 @@ void mixerChoices(void)
   mixerOsc1_NumberBox.height       = numberBoxHeight;
   ui.drawNumberBox(mixerOsc1_NumberBox);
 
-  NUMBER_BOX mixerOsc2_NumberBox;
   mixerOsc2_NumberBox.labelText            = "Oscillator 2";
   mixerOsc2_NumberBox.value                = initialMixerOsc2;
   mixerOsc2_NumberBox.minimumValue         = 0;
@@ -533,7 +835,6 @@ void mixerChoices(void)
   ui.drawNumberBox(mixerOsc2_NumberBox);
 
 
-  NUMBER_BOX mixerNoise_NumberBox;
   mixerNoise_NumberBox.labelText    = "Noise";
   mixerNoise_NumberBox.value        = initialMixerNoise;
   mixerNoise_NumberBox.minimumValue = 0;
@@ -545,7 +846,6 @@ void mixerChoices(void)
   mixerNoise_NumberBox.height       = numberBoxHeight;
   ui.drawNumberBox(mixerNoise_NumberBox);
   
-  NUMBER_BOX mixerSub_NumberBox;
   mixerSub_NumberBox.labelText    = "Sub";
   mixerSub_NumberBox.value        = initialMixerSub;
   mixerSub_NumberBox.minimumValue = 0;
@@ -560,53 +860,66 @@ void mixerChoices(void)
   //
   // define and display "OK" and "Cancel" buttons
   //
-  BUTTON okButton        = {"OK",     ui.displaySpaceCenterX,   ui.displaySpaceBottomY-27,  100 , numberBoxHeight};
-  ui.drawButton(okButton);
+  mixerOkButton = {"OK",     ui.displaySpaceCenterX,   ui.displaySpaceBottomY-27,  100 , numberBoxHeight};
+  ui.drawButton(mixerOkButton);
 
 
   //
-  // process touch events
+  // let the encoder move the number boxes too
   //
-  while(true)
-  {
-    ui.getTouchEvents();
+  menuBind(mixerOsc1_NumberBox, CCmixer1);
+  menuBind(mixerOsc2_NumberBox, CCmixer2);
+  menuBind(mixerNoise_NumberBox, CCmixer3);
+  menuBind(mixerSub_NumberBox, CCmixer4);
+}
 
-    //
-    // process touch events on the Number Boxes
-    //
-    if (ui.checkForNumberBoxTouched(mixerOsc1_NumberBox)){
-      setControlChange(CCmixer1, mixerOsc1_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(mixerOsc2_NumberBox)){
-      setControlChange(CCmixer2, mixerOsc2_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(mixerNoise_NumberBox)){
-      setControlChange(CCmixer3, mixerNoise_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(mixerSub_NumberBox)){
-      setControlChange(CCmixer4, mixerSub_NumberBox.value);
-    }
+//
+// process a touch event
+//
+byte mixerTouch(void)
+{
+  //
+  // process touch events on the Number Boxes
+  //
+  if (ui.checkForNumberBoxTouched(mixerOsc1_NumberBox)){
+    setControlChange(CCmixer1, mixerOsc1_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(mixerOsc2_NumberBox)){
+    setControlChange(CCmixer2, mixerOsc2_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(mixerNoise_NumberBox)){
+    setControlChange(CCmixer3, mixerNoise_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(mixerSub_NumberBox)){
+    setControlChange(CCmixer4, mixerSub_NumberBox.value);
+  }
 
+  //
+  // check for touch events on the "OK" button
+  //
+  if (ui.checkForButtonClicked(mixerOkButton))
+  {
     //
-    // check for touch events on the "OK" button
+    // save the values set by the user, configLoop() writes them to EEPROM later
     //
-    if (ui.checkForButtonClicked(okButton))
-    {
-      //
-      // save the values set by the user to EEPROM, then return to the menu
-      //
-      ui.writeConfigurationInt(EEPROM_MIXER_OSC1, mixerOsc1_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_MIXER_OSC2, mixerOsc2_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_MIXER_NOISE, mixerNoise_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_MIXER_SUB, mixerSub_NumberBox.value);
-      return;
-    }
+    config.set(CONFIG_MIXER_OSC1, mixerOsc1_NumberBox.value);
+    config.set(CONFIG_MIXER_OSC2, mixerOsc2_NumberBox.value);
+    config.set(CONFIG_MIXER_NOISE, mixerNoise_NumberBox.value);
+    config.set(CONFIG_MIXER_SUB, mixerSub_NumberBox.value);
+    return PAGE_MAIN;
   }
+  return PAGE_MIXER;
 }
 
 //
 // menu command that demonstrates how to prompt the user for info then save it
 //
+static NUMBER_BOX ampAttack_NumberBox;
+static NUMBER_BOX ampDecay_NumberBox;
+static NUMBER_BOX ampSustain_NumberBox;
+static NUMBER_BOX ampRelease_NumberBox;
+static BUTTON ampOkButton;
+
 void ampADSRChoices(void)
 {
   const int numberBoxWidth = 145;
@@ -614,12 +927,12 @@ void ampADSRChoices(void)
 
 
   //
-  // read initial values from the EEPROM, if the EEPROM has never been set, use default values
+  // read initial values from the config store, or the defaults if they have never been saved
   //
-  int initialAmpAttack = ui.readConfigurationInt(EEPROM_AMP_ATTACK, DEFAULT_AMP_ATTACK);
-  int initialAmpDecay = ui.readConfigurationInt(EEPROM_AMP_DECAY, DEFAULT_AMP_DECAY);
-  int initialAmpSustain = ui.readConfigurationInt(EEPROM_AMP_SUSTAIN, DEFAULT_AMP_SUSTAIN);
-  int initialAmpRelease = ui.readConfigurationInt(EEPROM_AMP_RELEASE, DEFAULT_AMP_RELEASE);
+  int initialAmpAttack = config.get(CONFIG_AMP_ATTACK, DEFAULT_AMP_ATTACK);
+  int initialAmpDecay = config.get(CONFIG_AMP_DECAY, DEFAULT_AMP_DECAY);
+  int initialAmpSustain = config.get(CONFIG_AMP_SUSTAIN, DEFAULT_AMP_SUSTAIN);
+  int initialAmpRelease = config.get(CONFIG_AMP_RELEASE, DEFAULT_AMP_RELEASE);
 
 
   //
@@ -632,7 +945,6 @@ void ampADSRChoices(void)
   //
   // define and display number boxes for setting calibration constants
   //
-  NUMBER_BOX ampAttack_NumberBox;
   ampAttack_NumberBox.labelText    = "Attack";
   ampAttack_NumberBox.value        = initialAmpAttack;
   ampAttack_NumberBox.minimumValue = 0;
@@ -644,7 +956,6 @@ void ampADSRChoices(void)
   ampAttack_NumberBox.height       = numberBoxHeight;
   ui.drawNumberBox(ampAttack_NumberBox);
 
-  NUMBER_BOX ampDecay_NumberBox;
   ampDecay_NumberBox.labelText            = "Decay";
   ampDecay_NumberBox.value                = initialAmpDecay;
   ampDecay_NumberBox.minimumValue         = 0;
@@ -657,7 +968,6 @@ void ampADSRChoices(void)
   ui.drawNumberBox(ampDecay_NumberBox);
 
 
-  NUMBER_BOX ampSustain_NumberBox;
   ampSustain_NumberBox.labelText    = "Sustain";
   ampSustain_NumberBox.value        = initialAmpSustain;
   ampSustain_NumberBox.minimumValue = 0;
@@ -669,7 +979,6 @@ void ampADSRChoices(void)
   ampSustain_NumberBox.height       = numberBoxHeight;
   ui.drawNumberBox(ampSustain_NumberBox);
 
-  NUMBER_BOX ampRelease_NumberBox;
   ampRelease_NumberBox.labelText            = "Release";
   ampRelease_NumberBox.value                = initialAmpRelease;
   ampRelease_NumberBox.minimumValue         = 0;
@@ -685,46 +994,53 @@ void ampADSRChoices(void)
   //
   // define and display "OK" and "Cancel" buttons
   //
-  BUTTON okButton        = {"OK",     ui.displaySpaceCenterX,   ui.displaySpaceBottomY-27,  100 , numberBoxHeight};
-  ui.drawButton(okButton);
+  ampOkButton = {"OK",     ui.displaySpaceCenterX,   ui.displaySpaceBottomY-27,  100 , numberBoxHeight};
+  ui.drawButton(ampOkButton);
 
 
   //
-  // process touch events
+  // let the encoder move the number boxes too
   //
-  while(true)
-  {
-    ui.getTouchEvents();
+  menuBind(ampAttack_NumberBox, CCattack);
+  menuBind(ampDecay_NumberBox, CCdecay);
+  menuBind(ampSustain_NumberBox, CCsustain);
+  menuBind(ampRelease_NumberBox, CCrelease);
+}
 
-    //
-    // process touch events on the Number Boxes
-    //
-    if (ui.checkForNumberBoxTouched(ampAttack_NumberBox)){
-      setControlChange(CCattack, ampAttack_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(ampDecay_NumberBox)){
-      setControlChange(CCdecay, ampDecay_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(ampSustain_NumberBox)){
-      setControlChange(CCsustain, ampSustain_NumberBox.value);
-    }
-    if (ui.checkForNumberBoxTouched(ampRelease_NumberBox)){
-      setControlChange(CCrelease, ampRelease_NumberBox.value);
-    }
+//
+// process a touch event
+//
+byte ampADSRTouch(void)
+{
+  //
+  // process touch events on the Number Boxes
+  //
+  if (ui.checkForNumberBoxTouched(ampAttack_NumberBox)){
+    setControlChange(CCattack, ampAttack_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(ampDecay_NumberBox)){
+    setControlChange(CCdecay, ampDecay_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(ampSustain_NumberBox)){
+    setControlChange(CCsustain, ampSustain_NumberBox.value);
+  }
+  if (ui.checkForNumberBoxTouched(ampRelease_NumberBox)){
+    setControlChange(CCrelease, ampRelease_NumberBox.value);
+  }
 
+  //
+  // check for touch events on the "OK" button
+  //
+  if (ui.checkForButtonClicked(ampOkButton))
+  {
     //
-    // check for touch events on the "OK" button
+    // save the values set by the user, configLoop() writes them to EEPROM later
     //
-    if (ui.checkForButtonClicked(okButton))
-    {
-      //
-      // save the values set by the user to EEPROM, then return to the menu
-      //
-      ui.writeConfigurationInt(EEPROM_AMP_ATTACK, ampAttack_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_AMP_DECAY, ampDecay_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_AMP_SUSTAIN, ampSustain_NumberBox.value);
-      ui.writeConfigurationInt(EEPROM_AMP_RELEASE, ampRelease_NumberBox.value);
-      return;
-    }
+    config.set(CONFIG_AMP_ATTACK, ampAttack_NumberBox.value);
+    config.set(CONFIG_AMP_DECAY, ampDecay_NumberBox.value);
+    config.set(CONFIG_AMP_SUSTAIN, ampSustain_NumberBox.value);
+    config.set(CONFIG_AMP_RELEASE, ampRelease_NumberBox.value);
+    return PAGE_MAIN;
   }
+  return PAGE_ADSR;
 }
@@ -0,0 +1,112 @@
+#ifndef MIDI_CLOCK_H__
+#define MIDI_CLOCK_H__
+
+#include <Audio.h>
+
+// MIDI clock follower.
+//
+// Clock ticks (24 per quarter note) arrive through USB with a millisecond
+// or so of jitter. Each tick is timestamped against the audio sample clock
+// and fed into a second order phase locked loop: the predicted time of the
+// next tick is pulled towards the measured one by 1/8 of the error and the
+// period by 1/64. Consumers read the filtered period and the predicted tick
+// times, which are steady enough to clock sequencers and LFOs directly.
+//
+// All of the work happens in tick(), so the cost is one update per clock
+// message and nothing per audio block. Everything is 32 bit: times are
+// samples in Q16 and compared modulo 2^32, which is fine as long as the
+// error stays under half a second.
+
+const byte MIDI_CLOCK_PPQN = 24;
+const byte MIDI_CLOCK_LOCK_TICKS = 24;       // one beat inside the window to lock
+const uint32_t MIDI_CLOCK_TIMEOUT = 22050;   // samples without a tick before we let go
+
+class MidiClockSync {
+  public:
+    void tick(uint32_t sampleTime);
+    void start();
+    void stop() { _running = false; }
+    void resume() { _running = true; }
+    void poll(uint32_t sampleTime);
+
+    bool running() { return _running; }
+    bool locked() { return _locked; }
+    uint32_t ticks() { return _ticks; }
+
+    // Filtered period, samples per tick in Q16
+    uint32_t samplesPerTickQ16() { return _periodQ16; }
+    float bpm() { return _periodQ16 ? (AUDIO_SAMPLE_RATE_EXACT * 65536.0f * 60.0f) / ((float)_periodQ16 * MIDI_CLOCK_PPQN) : 0; }
+
+    // Predicted sample time of the tick after the last one received
+    uint32_t nextTickSample() { return _lastTick + ((int32_t)(_predictedQ16 - (_lastTick << 16)) >> 16); }
+
+    // Predicted sample time of the next tick that is a multiple of ticksPerStep
+    uint32_t nextStepSample(byte ticksPerStep) {
+      uint32_t ahead = (ticksPerStep - (_ticks % ticksPerStep)) % ticksPerStep;
+      return nextTickSample() + ((ahead * _periodQ16) >> 16);
+    }
+
+  private:
+    uint32_t _lastTick = 0;          // samples
+    uint32_t _predictedQ16 = 0;      // samples in Q16, modulo 2^32
+    uint32_t _periodQ16 = 0;
+    uint32_t _ticks = 0;
+    byte _inWindow = 0;
+    bool _locked = false;
+    bool _running = false;
+    bool _primed = false;
+};
+
+void MidiClockSync::tick(uint32_t sampleTime) {
+  _ticks++;
+
+  if (!_primed) {
+    // First tick after a gap only gives us a phase
+    _primed = true;
+    _lastTick = sampleTime;
+    _periodQ16 = 0;
+    return;
+  }
+
+  if (_periodQ16 == 0) {
+    // Second tick gives the first period estimate
+    _periodQ16 = (sampleTime - _lastTick) << 16;
+    _predictedQ16 = (sampleTime << 16) + _periodQ16;
+    _lastTick = sampleTime;
+    return;
+  }
+
+  int32_t errorQ16 = (int32_t)((sampleTime << 16) - _predictedQ16);
+  _predictedQ16 += _periodQ16 + (errorQ16 >> 3);
+  int32_t period = _periodQ16 + (errorQ16 >> 6);
+  if (period < (1 << 16)) period = 1 << 16;
+  _periodQ16 = period;
+  _lastTick = sampleTime;
+
+  // Locked once a full beat lands within a quarter tick of the prediction
+  int32_t window = _periodQ16 >> 2;
+  if (errorQ16 < window && errorQ16 > -window) {
+    if (_inWindow < MIDI_CLOCK_LOCK_TICKS) _inWindow++;
+  } else {
+    _inWindow = 0;
+  }
+  _locked = (_inWindow >= MIDI_CLOCK_LOCK_TICKS);
+}
+
+// Song start: the next tick is tick zero
+void MidiClockSync::start() {
+  _ticks = 0;
+  _running = true;
+}
+
+// Call from loop(), drops the lock when the clock goes away
+void MidiClockSync::poll(uint32_t sampleTime) {
+  if (_primed && (sampleTime - _lastTick) > MIDI_CLOCK_TIMEOUT) {
+    _primed = false;
+    _locked = false;
+    _inWindow = 0;
+    _periodQ16 = 0;
+  }
+}
+
+#endif
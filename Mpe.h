@@ -0,0 +1,80 @@
+#ifndef MPE_H__
+#define MPE_H__
+
+#include <Arduino.h>
+
+// MPE zone bookkeeping.
+//
+// A zone is a master channel (1 for the lower zone, 16 for the upper) and
+// the member channels next to it. The controller sets the zone up with the
+// MPE Configuration Message, RPN 6 on the master channel with the number of
+// member channels as data entry MSB, and may change the pitch bend range
+// with RPN 0 on either the master or a member channel. Zero members turns
+// the zone off.
+//
+// MpeZone only watches those RPNs and answers which channel is what. The
+// per-note expression itself lives in per-voice arrays in SynthLib.h.
+
+const byte MPE_LOWER_MASTER = 1;
+const byte MPE_UPPER_MASTER = 16;
+
+class MpeZone {
+  public:
+    MpeZone(byte masterChannel) : _master(masterChannel) {
+      for (byte c = 0; c < 16; c++) {
+        _rpnMsb[c] = 127;
+        _rpnLsb[c] = 127;
+      }
+    }
+
+    void controlChange(byte channel, byte control, byte value);
+
+    bool active() { return _members != 0; }
+    byte members() { return _members; }
+    bool master(byte channel) { return _members && channel == _master; }
+    bool member(byte channel) {
+      if (!_members) return false;
+      byte distance = (_master == MPE_LOWER_MASTER) ? channel - _master : _master - channel;
+      return distance >= 1 && distance <= _members;
+    }
+
+    // Bend in cents for a 14 bit bend value centred on 0
+    int32_t bendCents(byte channel, int bend) {
+      int32_t range = (channel == _master) ? _masterRange : _memberRange;
+      return (bend * range * 100) / 8192;
+    }
+
+  private:
+    byte _master;
+    byte _members = 0;
+    byte _masterRange = 2;   // semitones, MPE defaults
+    byte _memberRange = 48;
+    byte _rpnMsb[16];
+    byte _rpnLsb[16];
+};
+
+void MpeZone::controlChange(byte channel, byte control, byte value) {
+  if (channel < 1 || channel > 16) return;
+  byte c = channel - 1;
+  switch (control) {
+    case 101:
+      _rpnMsb[c] = value;
+      break;
+    case 100:
+      _rpnLsb[c] = value;
+      break;
+    case 6:
+      if (_rpnMsb[c] != 0) break;
+      if (_rpnLsb[c] == 6 && channel == _master) {
+        _members = value > 15 ? 15 : value;
+        _masterRange = 2;
+        _memberRange = 48;
+      } else if (_rpnLsb[c] == 0 && (channel == _master || member(channel))) {
+        if (channel == _master) _masterRange = value;
+        else _memberRange = value;
+      }
+      break;
+  }
+}
+
+#endif
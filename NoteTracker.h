@@ -0,0 +1,166 @@
+#ifndef NOTE_TRACKER_H__
+#define NOTE_TRACKER_H__
+
+#include <Arduino.h>
+
+// Held note bookkeeping for the mono voice.
+//
+// Keys that are down and keys kept alive by the sustain pedal are two 128
+// bit sets. Every note in either set is also on a doubly linked list in the
+// order it was pressed, stored as prev/next arrays indexed by note number,
+// so press and release are a couple of array writes and never a search.
+// The note to sound is the tail of the list (last priority) or the lowest or
+// highest bit across the union of both sets, found with four count-leading
+// or trailing-zeros instructions.
+
+const byte NOTE_NONE = 255;
+
+enum NotePriority {
+  PRIORITY_LAST = 0,
+  PRIORITY_LOW,
+  PRIORITY_HIGH
+};
+
+// What the sounding note did after a press, release or pedal change
+enum NoteChange {
+  NOTE_SAME = 0,  // nothing to do
+  NOTE_START,     // from silence
+  NOTE_MOVE,      // from one note to another, legato if the player wants it
+  NOTE_STOP       // last note gone
+};
+
+class NoteTracker {
+  public:
+    NoteTracker() { clear(); }
+
+    NoteChange press(byte note, byte velocity);
+    NoteChange release(byte note);
+    NoteChange sustain(bool down);
+    void clear();
+
+    void priority(NotePriority priority) { _priority = priority; }
+    bool sounding() { return _note != NOTE_NONE; }
+    byte note() { return _note; }
+    byte velocity() { return _note == NOTE_NONE ? 0 : _velocity[_note]; }
+    byte count() { return _count; }
+    bool held(byte note) { return test(_held, note); }
+
+  private:
+    static bool test(const uint32_t *set, byte note) { return set[note >> 5] & (1UL << (note & 31)); }
+    static void set(uint32_t *set, byte note) { set[note >> 5] |= (1UL << (note & 31)); }
+    static void reset(uint32_t *set, byte note) { set[note >> 5] &= ~(1UL << (note & 31)); }
+
+    void link(byte note);
+    void unlink(byte note);
+    byte choose();
+    NoteChange update();
+
+    uint32_t _held[4];
+    uint32_t _sustained[4];
+    byte _prev[128];
+    byte _next[128];
+    byte _velocity[128];
+    byte _head = NOTE_NONE;
+    byte _tail = NOTE_NONE;
+    byte _count = 0;
+    byte _note = NOTE_NONE;
+    bool _pedal = false;
+    NotePriority _priority = PRIORITY_LAST;
+};
+
+void NoteTracker::clear() {
+  memset(_held, 0, sizeof(_held));
+  memset(_sustained, 0, sizeof(_sustained));
+  _head = NOTE_NONE;
+  _tail = NOTE_NONE;
+  _count = 0;
+  _note = NOTE_NONE;
+}
+
+void NoteTracker::link(byte note) {
+  _prev[note] = _tail;
+  _next[note] = NOTE_NONE;
+  if (_tail != NOTE_NONE) _next[_tail] = note;
+  else _head = note;
+  _tail = note;
+  _count++;
+}
+
+void NoteTracker::unlink(byte note) {
+  if (_prev[note] != NOTE_NONE) _next[_prev[note]] = _next[note];
+  else _head = _next[note];
+  if (_next[note] != NOTE_NONE) _prev[_next[note]] = _prev[note];
+  else _tail = _prev[note];
+  _count--;
+}
+
+byte NoteTracker::choose() {
+  if (_priority == PRIORITY_LAST) return _tail;
+
+  if (_priority == PRIORITY_LOW) {
+    for (byte w = 0; w < 4; w++) {
+      uint32_t bits = _held[w] | _sustained[w];
+      if (bits) return (w << 5) + __builtin_ctz(bits);
+    }
+  } else {
+    for (int8_t w = 3; w >= 0; w--) {
+      uint32_t bits = _held[w] | _sustained[w];
+      if (bits) return (w << 5) + 31 - __builtin_clz(bits);
+    }
+  }
+  return NOTE_NONE;
+}
+
+NoteChange NoteTracker::update() {
+  byte previous = _note;
+  _note = choose();
+  if (_note == previous) return NOTE_SAME;
+  if (_note == NOTE_NONE) return NOTE_STOP;
+  if (previous == NOTE_NONE) return NOTE_START;
+  return NOTE_MOVE;
+}
+
+NoteChange NoteTracker::press(byte note, byte velocity) {
+  if (note > 127) return NOTE_SAME;
+
+  // Pressed again while held or sustained: move it to the end of the list
+  if (test(_held, note) || test(_sustained, note)) unlink(note);
+  link(note);
+  set(_held, note);
+  reset(_sustained, note);
+  _velocity[note] = velocity;
+
+  // A repeated key is a new note even if the pitch does not change
+  NoteChange change = update();
+  if (change == NOTE_SAME && _note == note) return NOTE_MOVE;
+  return change;
+}
+
+NoteChange NoteTracker::release(byte note) {
+  if (note > 127 || !test(_held, note)) return NOTE_SAME;
+
+  reset(_held, note);
+  if (_pedal) {
+    set(_sustained, note);
+    return NOTE_SAME;
+  }
+  unlink(note);
+  return update();
+}
+
+// CC64. Lifting the pedal drops every note that is only sustained.
+NoteChange NoteTracker::sustain(bool down) {
+  _pedal = down;
+  if (down) return NOTE_SAME;
+
+  for (byte w = 0; w < 4; w++) {
+    while (_sustained[w]) {
+      byte note = (w << 5) + __builtin_ctz(_sustained[w]);
+      _sustained[w] &= _sustained[w] - 1;
+      unlink(note);
+    }
+  }
+  return update();
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef PARTS_H__
+#define PARTS_H__
+
+#include <Audio.h>
+#include "DualOsc.h"
+#include "FmBank.h"
+
+// Multi-timbral parts and the voice pool they share.
+//
+// Each MIDI channel maps to a part through a 16 entry table, so routing an
+// event is one array read. Part 0 is the lead (the mono/unison synth with
+// glide, LFO and sequencer) and gets every channel nobody else has claimed.
+// Parts 1-3 are plain polyphonic parts, one voice per note.
+//
+// Voices are not tied to a part. VoicePool hands them out on demand: a part
+// at its budget recycles its own oldest voice, otherwise it takes a voice
+// that is not held (its release tail is cut), preferring one that already
+// has its patch, and only then steals the oldest held voice of another part.
+// The caller reloads the patch when a voice changes owner.
+
+const byte SYNTH_PARTS = 4;
+const byte VOICE_POOL_MAX = 8;
+const byte VOICE_NONE = 255;
+
+// Per part voice settings, loaded into a voice's objects when it changes hands
+struct PartPatch {
+  byte wave1 = DUAL_OSC_SAW;
+  byte wave2 = DUAL_OSC_SAW;
+  float mix[4] = {0.33, 0.33, 0, 0};
+  float cutoff = 10000;
+  float resonance = 0.7;
+  float attack = 10.5;
+  float decay = 0;
+  float sustain = 1;
+  float release = 500;
+  int octave2 = 0;
+  float detune = 1;
+  bool sync = false;  // osc2 restarts with every osc1 cycle
+  float ring = 0;     // osc2 crossfaded into osc1 * osc2
+  // FM, operator ratios follow osc1's pitch
+  byte fmAlgorithm = FM_OFF;
+  float fmRatio[FM_OPERATORS] = {1, 1, 2, 3};
+  float fmLevel[FM_OPERATORS] = {1, 0.5, 0.3, 0.2};
+  float fmAttack[FM_OPERATORS] = {2, 2, 2, 2};
+  float fmDecay[FM_OPERATORS] = {300, 300, 300, 300};
+  float fmSustain[FM_OPERATORS] = {0.7, 0.5, 0.5, 0.5};
+  float fmRelease[FM_OPERATORS] = {300, 300, 300, 300};
+  float fmFeedback = 0;
+};
+
+struct Part {
+  PartPatch patch;
+  byte budget = 2;       // most voices this part may hold at once
+  int32_t level = 32767; // Q15 on the voice bus
+  int32_t pan = 0;       // -32767..32767
+  int32_t expression = 32767; // Q15, from a controller routed to level
+  float brightness = 1;       // cutoff scale, from a controller routed to cutoff
+};
+
+class VoicePool {
+  public:
+    void begin(byte voices, byte owner);
+
+    void budget(byte part, byte voices) { _budget[part] = voices; }
+    byte allocate(byte part);
+    void hold(byte voice, byte part, byte note);
+    void release(byte voice);
+    byte find(byte part, byte note);
+
+    byte owner(byte voice) { return _owner[voice]; }
+    byte note(byte voice) { return _note[voice]; }
+    bool held(byte voice) { return _held[voice]; }
+    byte count(byte part) { return _count[part]; }
+
+  private:
+    byte oldest(byte part, bool held);
+
+    byte _voices = 0;
+    byte _owner[VOICE_POOL_MAX];
+    byte _note[VOICE_POOL_MAX];
+    bool _held[VOICE_POOL_MAX];
+    uint32_t _age[VOICE_POOL_MAX];
+    uint32_t _clock = 0;
+    byte _count[SYNTH_PARTS];
+    byte _budget[SYNTH_PARTS];
+};
+
+void VoicePool::begin(byte voices, byte owner) {
+  _voices = voices > VOICE_POOL_MAX ? VOICE_POOL_MAX : voices;
+  for (byte v = 0; v < _voices; v++) {
+    _owner[v] = owner;
+    _note[v] = 0;
+    _held[v] = false;
+    _age[v] = 0;
+  }
+  for (byte p = 0; p < SYNTH_PARTS; p++) {
+    _count[p] = 0;
+    _budget[p] = _voices;
+  }
+}
+
+// Oldest voice that is (or is not) held, owned by part or by anyone if
+// part is VOICE_NONE
+byte VoicePool::oldest(byte part, bool held) {
+  byte best = VOICE_NONE;
+  for (byte v = 0; v < _voices; v++) {
+    if (_held[v] != held) continue;
+    if (part != VOICE_NONE && _owner[v] != part) continue;
+    if (best == VOICE_NONE || (int32_t)(_age[v] - _age[best]) < 0) best = v;
+  }
+  return best;
+}
+
+byte VoicePool::allocate(byte part) {
+  byte voice = VOICE_NONE;
+  if (_count[part] >= _budget[part]) voice = oldest(part, true);
+  if (voice == VOICE_NONE) voice = oldest(part, false);
+  if (voice == VOICE_NONE) voice = oldest(VOICE_NONE, false);
+  if (voice == VOICE_NONE) voice = oldest(VOICE_NONE, true);
+  if (voice != VOICE_NONE && _held[voice]) release(voice);
+  return voice;
+}
+
+void VoicePool::hold(byte voice, byte part, byte note) {
+  if (voice >= _voices) return;
+  if (_held[voice]) release(voice);
+  _owner[voice] = part;
+  _note[voice] = note;
+  _held[voice] = true;
+  _age[voice] = ++_clock;
+  _count[part]++;
+}
+
+void VoicePool::release(byte voice) {
+  if (voice >= _voices || !_held[voice]) return;
+  _held[voice] = false;
+  _age[voice] = ++_clock;
+  _count[_owner[voice]]--;
+}
+
+// Held voice playing note for part, VOICE_NONE if it has been stolen
+byte VoicePool::find(byte part, byte note) {
+  for (byte v = 0; v < _voices; v++) {
+    if (_held[v] && _owner[v] == part && _note[v] == note) return v;
+  }
+  return VOICE_NONE;
+}
+
+#endif
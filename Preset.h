@@ -0,0 +1,158 @@
+#ifndef PRESET_H__
+#define PRESET_H__
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <string.h>
+#include "Parts.h"
+
+// Binary preset, the whole sound of the synth in one packed struct.
+//
+// The layout is fixed: byte packed, little endian as the Teensy stores it,
+// and versioned. A preset is only accepted when the magic, version, size
+// and CRC all match, so anything written by another build is refused
+// rather than half applied. Add fields at the end and bump PRESET_VERSION.
+//
+// Part settings are stored as the patch values themselves. The global
+// settings (filter, LFO, unison, glide, effects...) are stored as the CC
+// value that set them, in the order of presetControls, and recalled
+// through the same CC code, so they cannot drift from what a knob does.
+// Sequencer state, the tuning and MPE setup belong to the performance,
+// not the sound, and are left alone.
+
+const uint32_t PRESET_MAGIC = 0x31505354; // "TSP1"
+const uint16_t PRESET_VERSION = 1;
+const byte PRESET_NAME_LENGTH = 16;
+
+// Global CCs held in a preset, listed in presetControls in SynthLib.h
+const byte PRESET_CONTROL_COUNT = 28;
+
+struct __attribute__((packed)) PresetPart {
+  uint8_t wave1;
+  uint8_t wave2;
+  float mix[4];
+  float cutoff;
+  float resonance;
+  float attack;
+  float decay;
+  float sustain;
+  float release;
+  int8_t octave2;
+  float detune;
+  uint8_t sync;
+  float ring;
+  uint8_t fmAlgorithm;
+  float fmRatio[FM_OPERATORS];
+  float fmLevel[FM_OPERATORS];
+  float fmAttack[FM_OPERATORS];
+  float fmDecay[FM_OPERATORS];
+  float fmSustain[FM_OPERATORS];
+  float fmRelease[FM_OPERATORS];
+  float fmFeedback;
+  uint8_t budget;
+  int16_t level;
+  int16_t pan;
+};
+
+struct __attribute__((packed)) Preset {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint16_t crc;       // CRC-16/CCITT of everything after this field
+  char name[PRESET_NAME_LENGTH];
+  uint8_t category;
+  uint8_t channelPart[16];
+  uint8_t controls[PRESET_CONTROL_COUNT];
+  PresetPart part[SYNTH_PARTS];
+};
+
+const uint16_t PRESET_CRC_OFFSET = offsetof(Preset, crc) + sizeof(uint16_t);
+
+uint16_t crc16(const uint8_t *data, uint32_t length, uint16_t crc = 0xFFFF) {
+  while (length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (byte bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+uint16_t presetCrc(const Preset &preset) {
+  return crc16((const uint8_t *)&preset + PRESET_CRC_OFFSET, sizeof(Preset) - PRESET_CRC_OFFSET);
+}
+
+// Fill in the header once the body is complete
+void presetSeal(Preset &preset, const char *name) {
+  preset.magic = PRESET_MAGIC;
+  preset.version = PRESET_VERSION;
+  preset.size = sizeof(Preset);
+  if (name) {
+    memset(preset.name, 0, PRESET_NAME_LENGTH);
+    strncpy(preset.name, name, PRESET_NAME_LENGTH);
+  }
+  preset.crc = presetCrc(preset);
+}
+
+bool presetValid(const Preset &preset) {
+  return preset.magic == PRESET_MAGIC && preset.version == PRESET_VERSION &&
+         preset.size == sizeof(Preset) && preset.crc == presetCrc(preset);
+}
+
+void presetPartStore(PresetPart &out, const Part &part) {
+  const PartPatch &patch = part.patch;
+  out.wave1 = patch.wave1;
+  out.wave2 = patch.wave2;
+  memcpy(out.mix, patch.mix, sizeof(out.mix));
+  out.cutoff = patch.cutoff;
+  out.resonance = patch.resonance;
+  out.attack = patch.attack;
+  out.decay = patch.decay;
+  out.sustain = patch.sustain;
+  out.release = patch.release;
+  out.octave2 = patch.octave2;
+  out.detune = patch.detune;
+  out.sync = patch.sync;
+  out.ring = patch.ring;
+  out.fmAlgorithm = patch.fmAlgorithm;
+  memcpy(out.fmRatio, patch.fmRatio, sizeof(out.fmRatio));
+  memcpy(out.fmLevel, patch.fmLevel, sizeof(out.fmLevel));
+  memcpy(out.fmAttack, patch.fmAttack, sizeof(out.fmAttack));
+  memcpy(out.fmDecay, patch.fmDecay, sizeof(out.fmDecay));
+  memcpy(out.fmSustain, patch.fmSustain, sizeof(out.fmSustain));
+  memcpy(out.fmRelease, patch.fmRelease, sizeof(out.fmRelease));
+  out.fmFeedback = patch.fmFeedback;
+  out.budget = part.budget;
+  out.level = part.level;
+  out.pan = part.pan;
+}
+
+void presetPartLoad(Part &part, const PresetPart &in) {
+  PartPatch &patch = part.patch;
+  patch.wave1 = in.wave1;
+  patch.wave2 = in.wave2;
+  memcpy(patch.mix, in.mix, sizeof(patch.mix));
+  patch.cutoff = in.cutoff;
+  patch.resonance = in.resonance;
+  patch.attack = in.attack;
+  patch.decay = in.decay;
+  patch.sustain = in.sustain;
+  patch.release = in.release;
+  patch.octave2 = in.octave2;
+  patch.detune = in.detune;
+  patch.sync = in.sync;
+  patch.ring = in.ring;
+  patch.fmAlgorithm = in.fmAlgorithm;
+  memcpy(patch.fmRatio, in.fmRatio, sizeof(patch.fmRatio));
+  memcpy(patch.fmLevel, in.fmLevel, sizeof(patch.fmLevel));
+  memcpy(patch.fmAttack, in.fmAttack, sizeof(patch.fmAttack));
+  memcpy(patch.fmDecay, in.fmDecay, sizeof(patch.fmDecay));
+  memcpy(patch.fmSustain, in.fmSustain, sizeof(patch.fmSustain));
+  memcpy(patch.fmRelease, in.fmRelease, sizeof(patch.fmRelease));
+  patch.fmFeedback = in.fmFeedback;
+  part.budget = in.budget;
+  part.level = in.level;
+  part.pan = in.pan;
+}
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef PRESET_BANK_H__
+#define PRESET_BANK_H__
+
+#include <Arduino.h>
+#include <SerialFlash.h>
+#include "Preset.h"
+
+// Banks of presets on the SerialFlash chip.
+//
+// A bank is one file: a header, a fixed size index of PRESET_BANK_SLOTS
+// entries (name, category and where the preset lives in the file) and the
+// presets themselves. Every bank's index is read into RAM by begin(), so a
+// program change is one bounded read of one preset at a known offset, no
+// directory walk and no parsing.
+//
+// Flash can only be written once between erases, so each bank has two
+// files. A save writes the whole bank into the file not in use, the
+// header last, with a generation one higher. begin() takes the valid copy
+// with the highest generation, so a save cut short by power loss leaves
+// the previous bank intact. Saving takes a while; do it from loop() or the
+// menu thread, never from the audio interrupt.
+//
+// A whole bank can also be written a preset at a time, as it arrives:
+// writeBegin() erases the spare file, write() puts each preset in place
+// and writeEnd() adds the index and header. Slots never written are empty.
+// writeAbort() gives up on a copy that will not be finished.
+
+const byte PRESET_BANKS = 4;
+const byte PRESET_BANK_SLOTS = 128;
+const uint32_t PRESET_BANK_MAGIC = 0x4B4E4254; // "TBNK"
+
+struct __attribute__((packed)) PresetIndexEntry {
+  char name[PRESET_NAME_LENGTH];
+  uint8_t category;
+  uint8_t used;
+  uint32_t offset;   // from the start of the file
+};
+
+struct __attribute__((packed)) PresetBankHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t slots;
+  uint32_t generation;
+  uint16_t crc;      // CRC-16/CCITT of the index
+};
+
+const uint32_t PRESET_BANK_DATA = sizeof(PresetBankHeader) + sizeof(PresetIndexEntry) * PRESET_BANK_SLOTS;
+const uint32_t PRESET_BANK_FILE_SIZE = PRESET_BANK_DATA + (uint32_t)sizeof(Preset) * PRESET_BANK_SLOTS;
+
+class PresetBank {
+  public:
+    void begin();
+
+    bool load(byte bank, byte program, Preset &preset);
+    bool save(byte bank, byte program, const Preset &preset);
+
+    bool writeBegin(byte bank);
+    bool write(byte program, const Preset &preset);
+    bool writeEnd();
+    void writeAbort();
+    int8_t writing() { return _writeBank; }
+
+    bool used(byte bank, byte program) {
+      return bank < PRESET_BANKS && program < PRESET_BANK_SLOTS && _index[bank][program].used;
+    }
+    const PresetIndexEntry &entry(byte bank, byte program) { return _index[bank % PRESET_BANKS][program % PRESET_BANK_SLOTS]; }
+
+  private:
+    static void fileName(char *name, byte bank, byte copy) { sprintf(name, "bank%d%c.tsp", bank, 'a' + copy); }
+    bool readIndex(byte bank, byte copy, PresetBankHeader &header, PresetIndexEntry *index);
+
+    PresetIndexEntry _index[PRESET_BANKS][PRESET_BANK_SLOTS];
+    uint32_t _generation[PRESET_BANKS];
+    int8_t _copy[PRESET_BANKS];   // file holding the bank, -1 for none yet
+
+    SerialFlashFile _out;
+    PresetIndexEntry _writeIndex[PRESET_BANK_SLOTS];
+    int8_t _writeBank = -1;
+};
+
+bool PresetBank::readIndex(byte bank, byte copy, PresetBankHeader &header, PresetIndexEntry *index) {
+  char name[16];
+  fileName(name, bank, copy);
+  if (!SerialFlash.exists(name)) return false;
+  SerialFlashFile file = SerialFlash.open(name);
+  if (!file) return false;
+  bool ok = file.read(&header, sizeof(header)) == sizeof(header) &&
+            header.magic == PRESET_BANK_MAGIC && header.version == PRESET_VERSION &&
+            header.slots == PRESET_BANK_SLOTS &&
+            file.read(index, sizeof(PresetIndexEntry) * PRESET_BANK_SLOTS) == sizeof(PresetIndexEntry) * PRESET_BANK_SLOTS &&
+            crc16((const uint8_t *)index, sizeof(PresetIndexEntry) * PRESET_BANK_SLOTS) == header.crc;
+  file.close();
+  return ok;
+}
+
+void PresetBank::begin() {
+  static PresetIndexEntry other[PRESET_BANK_SLOTS];
+  for (byte bank = 0; bank < PRESET_BANKS; bank++) {
+    PresetBankHeader header;
+    _copy[bank] = -1;
+    _generation[bank] = 0;
+    memset(_index[bank], 0, sizeof(_index[bank]));
+    if (readIndex(bank, 0, header, other)) {
+      memcpy(_index[bank], other, sizeof(other));
+      _copy[bank] = 0;
+      _generation[bank] = header.generation;
+    }
+    if (readIndex(bank, 1, header, other) && (_copy[bank] < 0 || (int32_t)(header.generation - _generation[bank]) > 0)) {
+      memcpy(_index[bank], other, sizeof(other));
+      _copy[bank] = 1;
+      _generation[bank] = header.generation;
+    }
+  }
+}
+
+bool PresetBank::load(byte bank, byte program, Preset &preset) {
+  if (!used(bank, program)) return false;
+  char name[16];
+  fileName(name, bank, _copy[bank]);
+  SerialFlashFile file = SerialFlash.open(name);
+  if (!file) return false;
+  file.seek(_index[bank][program].offset);
+  uint32_t length = file.read(&preset, sizeof(Preset));
+  file.close();
+  return length == sizeof(Preset) && presetValid(preset);
+}
+
+// Start a new copy of the bank in its other file
+bool PresetBank::writeBegin(byte bank) {
+  if (bank >= PRESET_BANKS) return false;
+  if (_writeBank >= 0) _out.close();
+  _writeBank = -1;
+  char name[16];
+  fileName(name, bank, _copy[bank] == 0 ? 1 : 0);
+  if (!SerialFlash.exists(name) && !SerialFlash.createErasable(name, PRESET_BANK_FILE_SIZE)) return false;
+  _out = SerialFlash.open(name);
+  if (!_out) return false;
+  _out.erase();
+  memset(_writeIndex, 0, sizeof(_writeIndex));
+  _writeBank = bank;
+  return true;
+}
+
+bool PresetBank::write(byte program, const Preset &preset) {
+  if (_writeBank < 0 || program >= PRESET_BANK_SLOTS || _writeIndex[program].used || !presetValid(preset)) return false;
+  PresetIndexEntry &entry = _writeIndex[program];
+  entry.offset = PRESET_BANK_DATA + (uint32_t)program * sizeof(Preset);
+  entry.used = 1;
+  memcpy(entry.name, preset.name, PRESET_NAME_LENGTH);
+  entry.category = preset.category;
+  _out.seek(entry.offset);
+  _out.write(&preset, sizeof(Preset));
+  return true;
+}
+
+// The header goes last, so until here begin() still takes the old copy
+bool PresetBank::writeEnd() {
+  if (_writeBank < 0) return false;
+  byte bank = _writeBank;
+  PresetBankHeader header;
+  header.magic = PRESET_BANK_MAGIC;
+  header.version = PRESET_VERSION;
+  header.slots = PRESET_BANK_SLOTS;
+  header.generation = _generation[bank] + 1;
+  header.crc = crc16((const uint8_t *)_writeIndex, sizeof(_writeIndex));
+  _out.seek(sizeof(header));
+  _out.write(_writeIndex, sizeof(_writeIndex));
+  _out.seek(0);
+  _out.write(&header, sizeof(header));
+  _out.close();
+
+  memcpy(_index[bank], _writeIndex, sizeof(_writeIndex));
+  _generation[bank] = header.generation;
+  _copy[bank] = _copy[bank] == 0 ? 1 : 0;
+  _writeBank = -1;
+  return true;
+}
+
+// Drop a new copy that will never be finished. Without its header begin()
+// never takes it, and the bank stays as it was.
+void PresetBank::writeAbort() {
+  if (_writeBank < 0) return;
+  _out.close();
+  _writeBank = -1;
+}
+
+// Rewrite the bank into its other file with one preset replaced
+bool PresetBank::save(byte bank, byte program, const Preset &preset) {
+  if (bank >= PRESET_BANKS || program >= PRESET_BANK_SLOTS || !presetValid(preset)) return false;
+  if (!writeBegin(bank)) return false;
+
+  static Preset copy;
+  SerialFlashFile in;
+  if (_copy[bank] >= 0) {
+    char name[16];
+    fileName(name, bank, _copy[bank]);
+    in = SerialFlash.open(name);
+  }
+  for (byte slot = 0; slot < PRESET_BANK_SLOTS; slot++) {
+    if (slot == program) {
+      write(slot, preset);
+    } else if (_index[bank][slot].used && in) {
+      in.seek(_index[bank][slot].offset);
+      if (in.read(&copy, sizeof(Preset)) == sizeof(Preset)) write(slot, copy);
+    }
+  }
+  if (in) in.close();
+  return writeEnd();
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+#include <Arduino.h>
+#include "DspUtil.h"
+
+// Run time histograms for named zones of the control code.
+//
+// A zone is timed with cycleCount(), the DWT cycle counter on the Teensy and
+// a steady clock in nanoseconds on the host, and each time goes into a
+// log2 histogram: bucket b counts times below 2^b ticks, so 32 counters
+// cover everything from one tick to the counter's wrap. Recording is a
+// count-leading-zeros and two increments, cheap enough to leave on.
+//
+// Most zones are scoped with ProfileScope around the code they time.
+// PROFILE_LOOP is different: mark() records the time since its last mark,
+// so marking it at the top of loop() gives the loop iteration time,
+// including whatever the other threads took in between.
+//
+// Each zone must only be recorded from one thread. reset() may be called from
+// any thread: it only flags the zones, and each is cleared by its own thread
+// at its next record() or mark(). report() prints a line
+// per zone with percentiles taken from the bucket edges, so they are upper
+// bounds within a factor of two, followed by the non-empty buckets.
+
+enum ProfileZone {PROFILE_LOOP, PROFILE_MIDI, PROFILE_ENCODER, PROFILE_LFO, PROFILE_DISPLAY, PROFILE_MENU, PROFILE_ZONES};
+
+const byte PROFILE_BUCKETS = 33;
+
+#if defined(ARDUINO)
+const uint32_t PROFILE_TICKS_PER_US = F_CPU / 1000000;
+#else
+const uint32_t PROFILE_TICKS_PER_US = 1000;
+#endif
+
+class Profiler {
+  public:
+    void begin() { cycleCounterBegin(); for (byte zone = 0; zone < PROFILE_ZONES; zone++) clear(zone); }
+    void record(byte zone, uint32_t ticks);
+    void mark(byte zone);
+    void reset();
+    void report(Print &out);
+
+  private:
+    static const char *const _names[PROFILE_ZONES];
+    static uint32_t toMicros(uint32_t ticks) { return (ticks + PROFILE_TICKS_PER_US - 1) / PROFILE_TICKS_PER_US; }
+    uint32_t percentile(byte zone, byte percent);
+    void clear(byte zone);
+
+    uint32_t _buckets[PROFILE_ZONES][PROFILE_BUCKETS];
+    uint32_t _count[PROFILE_ZONES];
+    uint32_t _max[PROFILE_ZONES];
+    uint32_t _markAt[PROFILE_ZONES];
+    volatile bool _resetPending[PROFILE_ZONES];
+};
+
+const char *const Profiler::_names[PROFILE_ZONES] = {"loop", "midi", "encoder", "lfo", "display", "menu"};
+
+class ProfileScope {
+  public:
+    ProfileScope(Profiler &profiler, byte zone) : _profiler(profiler), _zone(zone), _start(cycleCount()) {}
+    ~ProfileScope() { _profiler.record(_zone, cycleCount() - _start); }
+
+  private:
+    Profiler &_profiler;
+    byte _zone;
+    uint32_t _start;
+};
+
+void Profiler::record(byte zone, uint32_t ticks) {
+  if (zone >= PROFILE_ZONES) return;
+  if (_resetPending[zone]) clear(zone);
+  _buckets[zone][ticks ? 32 - __builtin_clz(ticks) : 0]++;
+  _count[zone]++;
+  if (ticks > _max[zone]) _max[zone] = ticks;
+}
+
+// The first mark after reset() only starts the clock
+void Profiler::mark(byte zone) {
+  if (zone >= PROFILE_ZONES) return;
+  if (_resetPending[zone]) clear(zone);
+  uint32_t now = cycleCount();
+  if (_markAt[zone]) record(zone, now - _markAt[zone]);
+  _markAt[zone] = now ? now : 1;
+}
+
+void Profiler::reset() {
+  for (byte zone = 0; zone < PROFILE_ZONES; zone++) _resetPending[zone] = true;
+}
+
+// Only from the zone's own thread, or before any thread has started
+void Profiler::clear(byte zone) {
+  memset(_buckets[zone], 0, sizeof(_buckets[zone]));
+  _count[zone] = 0;
+  _max[zone] = 0;
+  _markAt[zone] = 0;
+  _resetPending[zone] = false;
+}
+
+// Upper edge of the bucket holding the given percentile, in ticks, or the
+// largest time seen if that is lower
+uint32_t Profiler::percentile(byte zone, byte percent) {
+  uint32_t target = ((uint64_t)_count[zone] * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (byte b = 0; b < PROFILE_BUCKETS; b++) {
+    seen += _buckets[zone][b];
+    if (seen >= target) return b >= 32 || (1UL << b) > _max[zone] ? _max[zone] : (1UL << b);
+  }
+  return _max[zone];
+}
+
+void Profiler::report(Print &out) {
+  out.printf("zone        count  p50 us  p99 us  max us  buckets (us: count)\n");
+  for (byte zone = 0; zone < PROFILE_ZONES; zone++) {
+    if (_resetPending[zone] || !_count[zone]) continue;
+    out.printf("%-8s %8lu  %6lu  %6lu  %6lu ", _names[zone], _count[zone], toMicros(percentile(zone, 50)),
+               toMicros(percentile(zone, 99)), toMicros(_max[zone]));
+    // Buckets under a microsecond are printed together as <1
+    uint32_t small = 0;
+    for (byte b = 0; b < PROFILE_BUCKETS; b++) {
+      uint32_t n = _buckets[zone][b];
+      if (b < 32 && (1UL << b) <= PROFILE_TICKS_PER_US) {
+        small += n;
+        continue;
+      }
+      if (small) {
+        out.printf(" <1:%lu", small);
+        small = 0;
+      }
+      if (n) out.printf(" %lu:%lu", toMicros(b >= 32 ? 0xFFFFFFFF : (1UL << b)), n);
+    }
+    if (small) out.printf(" <1:%lu", small);
+    out.printf("\n");
+  }
+}
+
+#endif
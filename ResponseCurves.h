@@ -0,0 +1,86 @@
+#ifndef RESPONSE_CURVES_H__
+#define RESPONSE_CURVES_H__
+
+#include <Arduino.h>
+#include <math.h>
+#include "DspUtil.h"
+
+// Velocity and controller response as 128 entry Q15 tables.
+//
+// The shape is computed once when it is chosen, so the note path is a
+// single array read. USER keeps its own 128 points, drawn one at a time
+// with point(), and switching to another shape and back does not lose them.
+//
+// depthTable() folds a modulation depth into a second table, 1.0 at the top
+// of the curve and 1.0 - depth at the bottom, which is what a level or
+// cutoff scaler wants.
+
+const byte CURVE_POINTS = 128;
+
+enum ResponseShape {
+  CURVE_LINEAR = 0,
+  CURVE_SOFT,     // more output from light playing
+  CURVE_HARD,     // needs a heavy hand
+  CURVE_FIXED,    // ignores the input
+  CURVE_USER
+};
+
+class ResponseCurve {
+  public:
+    ResponseCurve() {
+      for (byte i = 0; i < CURVE_POINTS; i++) _user[i] = (i * 32767) / 127;
+      shape(CURVE_LINEAR);
+    }
+
+    void shape(ResponseShape shape);
+    void point(byte index, byte value);
+    void depthTable(int16_t *table, int32_t depthQ15);
+
+    ResponseShape shape() { return _shape; }
+    int16_t lookup(byte value) { return _table[value & 127]; }
+
+  private:
+    ResponseShape _shape = CURVE_LINEAR;
+    int16_t _table[CURVE_POINTS];
+    int16_t _user[CURVE_POINTS];
+};
+
+void ResponseCurve::shape(ResponseShape shape) {
+  _shape = shape;
+  for (byte i = 0; i < CURVE_POINTS; i++) {
+    float x = i / 127.0f;
+    float y = x;
+    switch (shape) {
+      case CURVE_SOFT:
+        y = sqrtf(x);
+        break;
+      case CURVE_HARD:
+        y = x * x;
+        break;
+      case CURVE_FIXED:
+        y = 100 / 127.0f;
+        break;
+      case CURVE_USER:
+        _table[i] = _user[i];
+        continue;
+      default:
+        break;
+    }
+    _table[i] = floatToQ15(y);
+  }
+}
+
+// Draw one point of the user curve, 0-127 maps to 0-1
+void ResponseCurve::point(byte index, byte value) {
+  if (index >= CURVE_POINTS) return;
+  _user[index] = (value * 32767) / 127;
+  if (_shape == CURVE_USER) _table[index] = _user[index];
+}
+
+void ResponseCurve::depthTable(int16_t *table, int32_t depthQ15) {
+  for (byte i = 0; i < CURVE_POINTS; i++) {
+    table[i] = 32767 - depthQ15 + mulQ15(depthQ15, _table[i]);
+  }
+}
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef SEQUENCER_H__
+#define SEQUENCER_H__
+
+#include <Audio.h>
+
+// Arpeggiator and step sequencer timed in audio samples.
+//
+// tick() is called from an AudioControlClock listener with the sample time
+// of the block about to be rendered. Step and gate times are kept in
+// samples (with an 8 bit fraction so tempos that are not a whole number of
+// samples do not drift), and every event that falls inside the block is
+// emitted right there in the audio interrupt. Display or menu load in
+// loop() can therefore never delay or bunch up a step; the only quantisation
+// is the audio block itself.
+//
+// The note callbacks run in the audio interrupt. Everything else (held keys,
+// start/stop, settings) is called from loop() inside AudioNoInterrupts().
+
+typedef void (*SequencerNoteOn)(byte note, byte velocity);
+typedef void (*SequencerNoteOff)(byte note);
+
+const byte ARP_MAX_NOTES = 16;
+const byte ARP_MAX_OCTAVES = 4;
+const byte SEQ_MAX_STEPS = 32;
+const byte SEQ_REST = 255;
+
+enum ArpMode {
+  ARP_UP = 0,
+  ARP_DOWN,
+  ARP_RANDOM,
+  ARP_AS_PLAYED
+};
+
+class SequencerBase {
+  public:
+    void begin(SequencerNoteOn noteOn, SequencerNoteOff noteOff) {
+      _noteOn = noteOn;
+      _noteOff = noteOff;
+    }
+
+    void tempo(float bpm, byte stepsPerBeat);
+    void stepLength(uint32_t samplesQ8);
+    void gate(byte percent);
+    void start(uint32_t sampleTime);
+    void align(uint32_t stepTime);
+    void stop() { _stopRequested = true; }
+    bool running() { return _running; }
+    uint32_t stepLength() { return _stepQ8; }
+
+    void tick(uint32_t blockStart, uint16_t blockSamples);
+
+  protected:
+    // Produce the note for the step being played, false for a rest
+    virtual bool nextNote(byte &note, byte &velocity) = 0;
+    virtual void restart() {}
+
+  private:
+    static bool before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+    void updateGate() { _gateSamples = ((uint64_t)_stepQ8 * _gatePercent / 100) >> 8; }
+
+    SequencerNoteOn _noteOn = NULL;
+    SequencerNoteOff _noteOff = NULL;
+
+    uint32_t _stepQ8 = 5512 << 8;   // 16ths at 120 BPM
+    uint32_t _gateSamples = 2756;
+    byte _gatePercent = 50;
+
+    uint32_t _nextStep = 0;
+    uint32_t _fraction = 0;
+    uint32_t _gateOffAt = 0;
+    byte _soundingNote = 0;
+    bool _sounding = false;
+    volatile bool _running = false;
+    volatile bool _stopRequested = false;
+};
+
+void SequencerBase::tempo(float bpm, byte stepsPerBeat) {
+  if (bpm < 20) bpm = 20;
+  if (stepsPerBeat == 0) stepsPerBeat = 1;
+  stepLength((AUDIO_SAMPLE_RATE_EXACT * 60.0f * 256.0f) / (bpm * stepsPerBeat));
+}
+
+// Samples per step with an 8 bit fraction
+void SequencerBase::stepLength(uint32_t samplesQ8) {
+  if (samplesQ8 < (AUDIO_BLOCK_SAMPLES << 8)) samplesQ8 = AUDIO_BLOCK_SAMPLES << 8;
+  _stepQ8 = samplesQ8;
+  updateGate();
+}
+
+void SequencerBase::gate(byte percent) {
+  if (percent < 1) percent = 1;
+  if (percent > 100) percent = 100;
+  _gatePercent = percent;
+  updateGate();
+}
+
+// First step lands on sampleTime, usually AudioControlClock::samples()
+void SequencerBase::start(uint32_t sampleTime) {
+  _nextStep = sampleTime;
+  _fraction = 0;
+  _stopRequested = false;
+  _running = true;
+  restart();
+}
+
+// Pull the next step onto an external grid. Ignored when it is more than half
+// a step away, so a step that has just been played is never repeated.
+void SequencerBase::align(uint32_t stepTime) {
+  if (!_running) return;
+  int32_t offset = stepTime - _nextStep;
+  int32_t half = _stepQ8 >> 9;
+  if (offset > -half && offset < half) {
+    _nextStep = stepTime;
+    _fraction = 0;
+  }
+}
+
+void SequencerBase::tick(uint32_t blockStart, uint16_t blockSamples) {
+  if (_stopRequested) {
+    if (_sounding) _noteOff(_soundingNote);
+    _sounding = false;
+    _running = false;
+    _stopRequested = false;
+  }
+  if (!_running) return;
+
+  uint32_t blockEnd = blockStart + blockSamples;
+  for (;;) {
+    bool stepDue = before(_nextStep, blockEnd);
+    bool gateDue = _sounding && before(_gateOffAt, blockEnd);
+
+    // Gate first when it ends on or before the next step
+    if (gateDue && (!stepDue || !before(_nextStep, _gateOffAt))) {
+      _noteOff(_soundingNote);
+      _sounding = false;
+      continue;
+    }
+    if (!stepDue) break;
+
+    if (_sounding) {
+      _noteOff(_soundingNote);
+      _sounding = false;
+    }
+
+    byte note;
+    byte velocity;
+    if (nextNote(note, velocity)) {
+      _noteOn(note, velocity);
+      _soundingNote = note;
+      _sounding = true;
+      _gateOffAt = _nextStep + _gateSamples;
+    }
+
+    _fraction += _stepQ8;
+    _nextStep += _fraction >> 8;
+    _fraction &= 0xFF;
+  }
+}
+
+
+class Arpeggiator : public SequencerBase {
+  public:
+    void mode(ArpMode mode) { _mode = mode; }
+    void octaves(byte count);
+
+    void noteOn(byte note, byte velocity);
+    void noteOff(byte note);
+    void clear() { _count = 0; }
+    byte heldCount() { return _count; }
+
+  protected:
+    bool nextNote(byte &note, byte &velocity);
+    void restart() { _position = 0; }
+
+  private:
+    byte _played[ARP_MAX_NOTES];          // in the order they were pressed
+    byte _playedVelocity[ARP_MAX_NOTES];
+    byte _sorted[ARP_MAX_NOTES];          // lowest first
+    byte _sortedVelocity[ARP_MAX_NOTES];
+    byte _count = 0;
+    byte _octaves = 1;
+    byte _position = 0;
+    ArpMode _mode = ARP_UP;
+    uint32_t _random = 0x12345678;
+};
+
+void Arpeggiator::octaves(byte count) {
+  if (count < 1) count = 1;
+  if (count > ARP_MAX_OCTAVES) count = ARP_MAX_OCTAVES;
+  _octaves = count;
+}
+
+void Arpeggiator::noteOn(byte note, byte velocity) {
+  if (_count >= ARP_MAX_NOTES) return;
+  for (byte i = 0; i < _count; i++) {
+    if (_played[i] == note) return;
+  }
+  _played[_count] = note;
+  _playedVelocity[_count] = velocity;
+
+  byte slot = _count;
+  while (slot > 0 && _sorted[slot - 1] > note) {
+    _sorted[slot] = _sorted[slot - 1];
+    _sortedVelocity[slot] = _sortedVelocity[slot - 1];
+    slot--;
+  }
+  _sorted[slot] = note;
+  _sortedVelocity[slot] = velocity;
+  _count++;
+}
+
+void Arpeggiator::noteOff(byte note) {
+  byte found = 0;
+  for (byte i = 0; i < _count; i++) {
+    if (_played[i] == note) found |= 1;
+    else if (found & 1) {
+      _played[i - 1] = _played[i];
+      _playedVelocity[i - 1] = _playedVelocity[i];
+    }
+    if (_sorted[i] == note) found |= 2;
+    else if (found & 2) {
+      _sorted[i - 1] = _sorted[i];
+      _sortedVelocity[i - 1] = _sortedVelocity[i];
+    }
+  }
+  if (found) _count--;
+}
+
+bool Arpeggiator::nextNote(byte &note, byte &velocity) {
+  if (_count == 0) return false;
+
+  byte total = _count * _octaves;
+  byte index = _position % total;
+  _position = (index + 1) % total;
+
+  switch (_mode) {
+    case ARP_DOWN:
+      index = total - 1 - index;
+      break;
+    case ARP_RANDOM:
+      _random ^= _random << 13;
+      _random ^= _random >> 17;
+      _random ^= _random << 5;
+      index = _random % total;
+      break;
+    default:
+      break;
+  }
+
+  byte octave = index / _count;
+  byte slot = index % _count;
+  if (_mode == ARP_AS_PLAYED) {
+    note = _played[slot];
+    velocity = _playedVelocity[slot];
+  } else {
+    note = _sorted[slot];
+    velocity = _sortedVelocity[slot];
+  }
+  while (octave > 0 && note + (12 * octave) > 127) octave--;
+  note += 12 * octave;
+  return true;
+}
+
+
+class StepSequencer : public SequencerBase {
+  public:
+    StepSequencer() {
+      for (byte i = 0; i < SEQ_MAX_STEPS; i++) {
+        _note[i] = SEQ_REST;
+        _velocity[i] = 100;
+      }
+    }
+
+    void length(byte steps);
+    byte length() { return _length; }
+    void setStep(byte index, byte note, byte velocity);
+    void transpose(int8_t semitones) { _transpose = semitones; }
+
+    // Step recording: each call fills the next step, SEQ_REST for a rest
+    void recordStart() { _recordPosition = 0; }
+    void record(byte note, byte velocity);
+
+  protected:
+    bool nextNote(byte &note, byte &velocity);
+    void restart() { _position = 0; }
+
+  private:
+    byte _note[SEQ_MAX_STEPS];
+    byte _velocity[SEQ_MAX_STEPS];
+    byte _length = 16;
+    byte _position = 0;
+    byte _recordPosition = 0;
+    int8_t _transpose = 0;
+};
+
+void StepSequencer::length(byte steps) {
+  if (steps < 1) steps = 1;
+  if (steps > SEQ_MAX_STEPS) steps = SEQ_MAX_STEPS;
+  _length = steps;
+}
+
+void StepSequencer::setStep(byte index, byte note, byte velocity) {
+  if (index >= SEQ_MAX_STEPS) return;
+  _note[index] = note;
+  _velocity[index] = velocity;
+}
+
+void StepSequencer::record(byte note, byte velocity) {
+  setStep(_recordPosition, note, velocity);
+  _recordPosition = (_recordPosition + 1) % _length;
+}
+
+bool StepSequencer::nextNote(byte &note, byte &velocity) {
+  byte step = _position;
+  _position = (_position + 1) % _length;
+  if (_note[step] == SEQ_REST) return false;
+
+  int transposed = _note[step] + _transpose;
+  if (transposed < 0 || transposed > 127) return false;
+  note = transposed;
+  velocity = _velocity[step];
+  return true;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef SOFT_LIMITER_H__
+#define SOFT_LIMITER_H__
+
+#include <Audio.h>
+#include <math.h>
+#include "DspUtil.h"
+
+// Stereo output stage: drive, lookahead peak limiter, then a table based
+// soft clipper.
+//
+// The input is multiplied by the drive and kept in 32 bits, so a hot mix
+// can go above full scale without wrapping. The limiter looks 32 samples
+// ahead: each 32 sample slice is scanned for its peak, one divide turns that
+// into a target gain, and the delayed slice is ramped linearly towards the
+// lower of its own and the next slice's target. Every sample therefore stays
+// under the threshold with no per-sample divide or branch.
+//
+// What is left between the knee and the threshold is rounded off by a tanh
+// curve stored as a 513 entry table with linear interpolation.
+
+const uint8_t LIMITER_LOOKAHEAD = 32;   // samples, also the gain update interval
+const uint16_t SOFTCLIP_TABLE_SIZE = 513;
+const uint8_t SOFTCLIP_TABLE_SHIFT = 7; // table covers 0..2x full scale
+
+class AudioEffectSoftLimiter : public AudioStream {
+  public:
+    AudioEffectSoftLimiter() : AudioStream(2, inputQueueArray) {
+      memset(_delayL, 0, sizeof(_delayL));
+      memset(_delayR, 0, sizeof(_delayR));
+      knee(0.5);
+      drive(1.0);
+      threshold(1.5);
+      releaseTime(150);
+    }
+    virtual void update(void);
+
+    void drive(float gain);
+    void threshold(float level);
+    void releaseTime(float milliseconds);
+    void knee(float level);
+    float gain() { return _gainQ30 * (1.0f / 1073741824.0f); }
+
+  private:
+    int16_t softClip(int32_t x) {
+      uint32_t mag = (x < 0) ? -x : x;
+      uint32_t index = mag >> SOFTCLIP_TABLE_SHIFT;
+      if (index >= SOFTCLIP_TABLE_SIZE - 1) return (x < 0) ? -_table[SOFTCLIP_TABLE_SIZE - 1] : _table[SOFTCLIP_TABLE_SIZE - 1];
+      int32_t a = _table[index];
+      int32_t b = _table[index + 1];
+      int32_t y = a + (((b - a) * (int32_t)(mag & ((1 << SOFTCLIP_TABLE_SHIFT) - 1))) >> SOFTCLIP_TABLE_SHIFT);
+      return (x < 0) ? -y : y;
+    }
+
+    audio_block_t *inputQueueArray[2];
+    int32_t _delayL[LIMITER_LOOKAHEAD];
+    int32_t _delayR[LIMITER_LOOKAHEAD];
+    int16_t _table[SOFTCLIP_TABLE_SIZE];
+
+    int32_t _driveQ8 = 256;
+    int32_t _threshold = 49151;       // in driven sample units
+    int32_t _releaseQ15 = 0;          // per slice
+    int32_t _gainQ30 = 1 << 30;
+    int32_t _previousTargetQ30 = 1 << 30;
+    bool _idle = false;
+};
+
+// Pre gain into the limiter, 1..4
+void AudioEffectSoftLimiter::drive(float gain) {
+  if (gain < 1.0f) gain = 1.0f;
+  if (gain > 4.0f) gain = 4.0f;
+  _driveQ8 = gain * 256.0f;
+}
+
+// Limiter ceiling relative to full scale, 0.5..2. Above 1 the soft clipper
+// does the last part of the job.
+void AudioEffectSoftLimiter::threshold(float level) {
+  if (level < 0.5f) level = 0.5f;
+  if (level > 2.0f) level = 2.0f;
+  _threshold = level * 32767.0f;
+}
+
+void AudioEffectSoftLimiter::releaseTime(float milliseconds) {
+  float slices = milliseconds * (AUDIO_SAMPLE_RATE_EXACT / 1000.0f) / LIMITER_LOOKAHEAD;
+  if (slices < 1.0f) slices = 1.0f;
+  _releaseQ15 = floatToQ15(1.0f - expf(-1.0f / slices));
+}
+
+// Level where the clipper starts to bend, 0..1 of full scale. Rebuilds the table.
+void AudioEffectSoftLimiter::knee(float level) {
+  if (level < 0.0f) level = 0.0f;
+  if (level > 0.95f) level = 0.95f;
+  for (uint16_t i = 0; i < SOFTCLIP_TABLE_SIZE; i++) {
+    float x = (i << SOFTCLIP_TABLE_SHIFT) / 32768.0f;
+    float y = x;
+    if (x > level) y = level + (1.0f - level) * tanhf((x - level) / (1.0f - level));
+    _table[i] = y * 32767.0f;
+  }
+}
+
+void AudioEffectSoftLimiter::update(void) {
+  audio_block_t *blockL = receiveWritable(0);
+  audio_block_t *blockR = receiveWritable(1);
+  if (!blockL && !blockR) {
+    // Run one silent block to flush the lookahead, then stop
+    if (_idle) return;
+    _idle = true;
+  } else {
+    _idle = false;
+  }
+  if (!blockL) {
+    blockL = allocate();
+    if (!blockL) { if (blockR) release(blockR); return; }
+    memset(blockL->data, 0, sizeof(blockL->data));
+  }
+  if (!blockR) {
+    blockR = allocate();
+    if (!blockR) { release(blockL); return; }
+    memset(blockR->data, 0, sizeof(blockR->data));
+  }
+
+  for (uint16_t base = 0; base < AUDIO_BLOCK_SAMPLES; base += LIMITER_LOOKAHEAD) {
+    int16_t *left = blockL->data + base;
+    int16_t *right = blockR->data + base;
+
+    // Peak of the incoming slice, after drive
+    int32_t peak = 0;
+    for (uint8_t n = 0; n < LIMITER_LOOKAHEAD; n++) {
+      int32_t l = (left[n] * _driveQ8) >> 8;
+      int32_t r = (right[n] * _driveQ8) >> 8;
+      if (l < 0) l = -l;
+      if (r < 0) r = -r;
+      if (l > peak) peak = l;
+      if (r > peak) peak = r;
+    }
+    int32_t targetQ30 = 1 << 30;
+    if (peak > _threshold) targetQ30 = ((int64_t)_threshold << 30) / peak;
+
+    // Ramp over the delayed slice to whichever is lower: its own target,
+    // the incoming slice's target, or the release curve
+    int32_t nextQ30 = _gainQ30 + (int32_t)(((int64_t)((1 << 30) - _gainQ30) * _releaseQ15) >> 15);
+    if (_previousTargetQ30 < nextQ30) nextQ30 = _previousTargetQ30;
+    if (targetQ30 < nextQ30) nextQ30 = targetQ30;
+    int32_t stepQ30 = (nextQ30 - _gainQ30) / LIMITER_LOOKAHEAD;
+
+    int32_t gainQ30 = _gainQ30;
+    for (uint8_t n = 0; n < LIMITER_LOOKAHEAD; n++) {
+      gainQ30 += stepQ30;
+      int32_t l = _delayL[n];
+      int32_t r = _delayR[n];
+      _delayL[n] = (left[n] * _driveQ8) >> 8;
+      _delayR[n] = (right[n] * _driveQ8) >> 8;
+      left[n] = softClip(((int64_t)l * gainQ30) >> 30);
+      right[n] = softClip(((int64_t)r * gainQ30) >> 30);
+    }
+    _gainQ30 = nextQ30;
+    _previousTargetQ30 = targetQ30;
+  }
+
+  transmit(blockL, 0);
+  transmit(blockR, 1);
+  release(blockL);
+  release(blockR);
+}
+
+#endif
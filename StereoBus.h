@@ -0,0 +1,156 @@
+#ifndef STEREO_BUS_H__
+#define STEREO_BUS_H__
+
+#include <Audio.h>
+#include "DspUtil.h"
+
+// Stereo voice bus: up to STEREO_BUS_INPUTS mono voices in, one stereo pair out.
+//
+// Every input has a level and a constant power pan. The whole block is
+// accumulated into one interleaved L/R int32 buffer and only saturated once
+// on the way out, so a stereo per-voice mix costs two multiply-adds per
+// sample per voice instead of a cascade of AudioMixer4 objects per side.
+// Level, pan and master changes ramp across one block to avoid zipper noise.
+
+const uint8_t STEREO_BUS_INPUTS = 8;
+const uint8_t PAN_TABLE_SIZE = 33;
+
+// sin(x) for x in 0..pi/2, Q15, used for constant power panning
+const int16_t PAN_TABLE[PAN_TABLE_SIZE] = {
+  0, 1608, 3212, 4808, 6393, 7962, 9512, 11039, 12539, 14010, 15446, 16846, 18204,
+  19519, 20787, 22005, 23170, 24279, 25329, 26319, 27245, 28105, 28898, 29621, 30273,
+  30852, 31356, 31785, 32137, 32412, 32609, 32728, 32767
+};
+
+class AudioMixerStereoBus : public AudioStream {
+  public:
+    AudioMixerStereoBus() : AudioStream(STEREO_BUS_INPUTS, inputQueueArray) {
+      for (uint8_t i = 0; i < STEREO_BUS_INPUTS; i++) {
+        _level[i] = 32767;
+        _pan[i] = 0;
+        updateGains(i);
+        _gainL[i] = _targetL[i];
+        _gainR[i] = _targetR[i];
+      }
+    }
+    virtual void update(void);
+
+    // Level 0..32767 (Q15)
+    void level(uint8_t channel, int32_t q15) {
+      if (channel >= STEREO_BUS_INPUTS) return;
+      _level[channel] = q15;
+      updateGains(channel);
+    }
+
+    // Pan -32767 (left) .. 32767 (right)
+    void pan(uint8_t channel, int32_t position) {
+      if (channel >= STEREO_BUS_INPUTS) return;
+      if (position < -32767) position = -32767;
+      if (position > 32767) position = 32767;
+      _pan[channel] = position;
+      updateGains(channel);
+    }
+
+    void master(float gain) { _masterTarget = gain * 32767.0f; }
+
+  private:
+    static int32_t panCurve(int32_t position) {
+      // 0..65534 across the table, linear between points
+      uint32_t x = position + 32767;
+      uint32_t index = x >> 11;
+      int32_t frac = x & 2047;
+      if (index >= PAN_TABLE_SIZE - 1) return PAN_TABLE[PAN_TABLE_SIZE - 1];
+      return PAN_TABLE[index] + (((PAN_TABLE[index + 1] - PAN_TABLE[index]) * frac) >> 11);
+    }
+
+    void updateGains(uint8_t channel) {
+      _targetL[channel] = mulQ15(_level[channel], panCurve(-_pan[channel]));
+      _targetR[channel] = mulQ15(_level[channel], panCurve(_pan[channel]));
+    }
+
+    audio_block_t *inputQueueArray[STEREO_BUS_INPUTS];
+    int32_t _accumulator[AUDIO_BLOCK_SAMPLES * 2];
+
+    int32_t _level[STEREO_BUS_INPUTS];
+    int32_t _pan[STEREO_BUS_INPUTS];
+    volatile int32_t _targetL[STEREO_BUS_INPUTS];
+    volatile int32_t _targetR[STEREO_BUS_INPUTS];
+    int32_t _gainL[STEREO_BUS_INPUTS];
+    int32_t _gainR[STEREO_BUS_INPUTS];
+    int32_t _master = 32767;
+    volatile int32_t _masterTarget = 32767;
+};
+
+void AudioMixerStereoBus::update(void) {
+  bool any = false;
+
+  for (uint8_t i = 0; i < STEREO_BUS_INPUTS; i++) {
+    audio_block_t *in = receiveReadOnly(i);
+    int32_t targetL = _targetL[i];
+    int32_t targetR = _targetR[i];
+    if (!in) {
+      _gainL[i] = targetL;
+      _gainR[i] = targetR;
+      continue;
+    }
+
+    // Ramp in Q15 << 7 so a full swing spreads evenly over the block,
+    // multiply at Q12 to leave headroom for all inputs in the accumulator
+    int32_t gainL = _gainL[i] << 7;
+    int32_t gainR = _gainR[i] << 7;
+    int32_t stepL = (targetL - _gainL[i]);
+    int32_t stepR = (targetR - _gainR[i]);
+    const int16_t *data = in->data;
+
+    if (!any) {
+      for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES; n++) {
+        gainL += stepL;
+        gainR += stepR;
+        _accumulator[2 * n] = data[n] * (gainL >> 10);
+        _accumulator[2 * n + 1] = data[n] * (gainR >> 10);
+      }
+      any = true;
+    } else {
+      for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES; n++) {
+        gainL += stepL;
+        gainR += stepR;
+        _accumulator[2 * n] += data[n] * (gainL >> 10);
+        _accumulator[2 * n + 1] += data[n] * (gainR >> 10);
+      }
+    }
+    _gainL[i] = targetL;
+    _gainR[i] = targetR;
+    release(in);
+  }
+
+  int32_t masterTarget = _masterTarget;
+  if (!any) {
+    _master = masterTarget;
+    return;
+  }
+
+  audio_block_t *outL = allocate();
+  if (!outL) return;
+  audio_block_t *outR = allocate();
+  if (!outR) {
+    release(outL);
+    return;
+  }
+
+  // Q12 sum (eight full scale inputs fit), master gain, 16 bit only at the very end
+  int32_t master = _master << 7;
+  int32_t step = masterTarget - _master;
+  for (uint16_t n = 0; n < AUDIO_BLOCK_SAMPLES; n++) {
+    master += step;
+    outL->data[n] = saturate16(((int64_t)_accumulator[2 * n] * (master >> 7)) >> 27);
+    outR->data[n] = saturate16(((int64_t)_accumulator[2 * n + 1] * (master >> 7)) >> 27);
+  }
+  _master = masterTarget;
+
+  transmit(outL, 0);
+  transmit(outR, 1);
+  release(outL);
+  release(outR);
+}
+
+#endif
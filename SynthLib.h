@@ -16,11 +16,34 @@
 #include <Wire.h>
 #include <SPI.h>
 #include <SerialFlash.h>
+#include <TeensyThreads.h>
+#include "AudioClock.h"
+#include "Sequencer.h"
+#include "MidiClock.h"
+#include "NoteTracker.h"
+#include "Glide.h"
+#include "Parts.h"
+#include "Mpe.h"
+#include "ResponseCurves.h"
+#include "Tuning.h"
+#include "EnsembleChorus.h"
+#include "FdnReverb.h"
+#include "SoftLimiter.h"
+#include "StereoBus.h"
+#include "EnvelopeBank.h"
+#include "DualOsc.h"
+#include "FmBank.h"
+#include "Preset.h"
+#include "PresetBank.h"
+#include "ConfigStore.h"
+#include "SysexTransfer.h"
+#include "Automation.h"
+#include "Profile.h"
 
 
 //MIDI CC control numbers
-#define CCmixer1 100
-#define CCmixer2 101
+#define CCmixer1 52     // were 100 and 101, the RPN select, see rpnControl(). 52-63 are the
+#define CCmixer2 53     // LSBs of the undefined CCs 20-31, so no standard controller sends them
 #define CCmixer3 102
 #define CCmixer4 103
 #define CCoctave 104
@@ -37,33 +60,107 @@
 #define CClfospeed 115
 #define CClfodepth 116
 #define CClfomode 117
+#define CCreverbmix 118
+#define CCreverbsize 119
+#define CCreverbdamp 85
+#define CCreverbquality 86
+#define CCchorusmix 87
+#define CCchorusrate 88
+#define CCchorusdepth 89
+#define CCdrive 90
+#define CCunison 20
+#define CCunisondetune 21
+#define CCspread 22
+#define CCwidthtrack 23
+#define CCseqmode 24
+#define CCarpmode 25
+#define CCarpoctaves 26
+#define CCseqgate 27
+#define CCtempo 28
+#define CCseqlength 29
+#define CCseqrecord 30
+#define CCclocksync 31
+#define CCpedal 64
+#define CCpriority 14
+#define CClegato 15
+#define CCglide 3
+#define CCglidemode 9
+#define CCpartchannel 16
+#define CCpartvoices 17
+#define CCpartlevel 18
+#define CCpartpan 19
+#define CCmodwheel 1
+#define CCvelocurve 80
+#define CCvelamp 81
+#define CCvelfilter 82
+#define CCmodroute 83
+#define CCpressroute 75
+#define CCcurveindex 76
+#define CCcurvevalue 77
+#define CCtuning 78
+#define CCenvcurve 79
+#define CCenvvelocity 13
+#define CCfmalgo 70
+#define CCfmoperator 71
+#define CCfmratio 72
+#define CCfmlevel 73
+#define CCfmattack 91
+#define CCfmdecay 92
+#define CCfmsustain 93
+#define CCfmrelease 94
+#define CCfmfeedback 95
+#define CCoscsync 84
+#define CCringmod 12
+#define CCbankselect 0
+#define CCautomation 54       // not 4 and 5, the foot controller and portamento time,
+#define CCautomationbars 55   // which a pedal or knob sweeps through
+
+// Where the mod wheel and aftertouch go, CCmodroute and CCpressroute
+#define ROUTE_OFF 0
+#define ROUTE_LEVEL 1
+#define ROUTE_CUTOFF 2
+#define ROUTE_LFO 3
+
+// Preset recall, see presetTick()
+#define PRESET_IDLE 0
+#define PRESET_FADE 1
+#define PRESET_SWAP 2
+
+// Sequencer modes, CCseqmode
+#define SEQ_MODE_OFF 0
+#define SEQ_MODE_ARP 1
+#define SEQ_MODE_STEP 2
+
+// Voice chains, each is osc1/osc2/noise/sub (or FM) into its own filter and envelope
+const byte SYNTH_VOICES = 4;
 
 // GUItool: begin automatically generated code
-AudioSynthNoisePink      pink1;          //xy=184,348
-AudioSynthWaveform       waveform2;      //xy=189,303
-AudioSynthWaveform       waveform3;      //xy=190,396
-AudioSynthWaveform       waveform1;      //xy=193,244
-AudioMixer4              mixer1;         //xy=384,304
-AudioFilterStateVariable filter1;        //xy=532,307
-AudioEffectEnvelope      envelope1;      //xy=695,308
-AudioAmplifier           amp1;           //xy=887,303
-AudioEffectDelay         delay1;         //xy=1011,409
+AudioControlClock        audioClock;     // must stay first, see AudioClock.h
+AudioSynthNoisePink      pink1[SYNTH_VOICES];      //xy=184,348
+AudioSynthWaveform       waveform3[SYNTH_VOICES];  //xy=190,396
+AudioSynthDualOsc        dualOsc[SYNTH_VOICES];    //xy=193,274
+AudioMixer4              mixer1[SYNTH_VOICES];     //xy=384,304
+AudioSynthFmBank         fm1;            //xy=460,304
+AudioFilterStateVariable filter1[SYNTH_VOICES];    //xy=532,307
+AudioEffectEnvelopeBank  envelope1;      //xy=695,308
+AudioMixerStereoBus      voiceBus;       //xy=887,303
+AudioEffectEnsemble      ensemble1;      //xy=1050,307
+AudioEffectFdnReverb     reverb1;        //xy=1100,307
+AudioEffectSoftLimiter   limiter1;       //xy=1140,307
 AudioOutputI2S           i2s1;           //xy=1177,307
-AudioConnection          patchCord1(pink1, 0, mixer1, 2);
-AudioConnection          patchCord2(waveform2, 0, mixer1, 1);
-AudioConnection          patchCord3(waveform3, 0, mixer1, 3);
-AudioConnection          patchCord4(waveform1, 0, mixer1, 0);
-AudioConnection          patchCord5(mixer1, 0, filter1, 0);
-AudioConnection          patchCord6(filter1, 0, envelope1, 0);
-AudioConnection          patchCord7(envelope1, amp1);
-AudioConnection          patchCord8(amp1, delay1);
-AudioConnection          patchCord9(amp1, 0, i2s1, 0);
-AudioConnection          patchCord10(delay1, 0, i2s1, 1);
+AudioConnection          voiceCords[SYNTH_VOICES * 8]; // connected in synthSetup()
+AudioConnection          patchCord1(voiceBus, 0, ensemble1, 0);
+AudioConnection          patchCord2(voiceBus, 1, ensemble1, 1);
+AudioConnection          patchCord3(ensemble1, 0, reverb1, 0);
+AudioConnection          patchCord4(ensemble1, 1, reverb1, 1);
+AudioConnection          patchCord5(reverb1, 0, limiter1, 0);
+AudioConnection          patchCord6(reverb1, 1, limiter1, 1);
+AudioConnection          patchCord7(limiter1, 0, i2s1, 0);
+AudioConnection          patchCord8(limiter1, 1, i2s1, 1);
 // GUItool: end automatically generated code
 
 
 // GLOBAL VARIABLES
-const byte BUFFER = 8; //Size of keyboard buffer
 const float noteFreqs[128] = {8.176, 8.662, 9.177, 9.723, 10.301, 10.913, 11.562, 12.25, 12.978, 13.75, 14.568, 15.434, 16.352, 17.324, 18.354, 19.445, 20.602, 21.827, 23.125, 24.5, 25.957, 27.5, 29.135, 30.868, 32.703, 34.648, 36.708, 38.891, 41.203, 43.654, 46.249, 48.999, 51.913, 55, 58.27, 61.735, 65.406, 69.296, 73.416, 77.782, 82.407, 87.307, 92.499, 97.999, 103.826, 110, 116.541, 123.471, 130.813, 138.591, 146.832, 155.563, 164.814, 174.614, 184.997, 195.998, 207.652, 220, 233.082, 246.942, 261.626, 277.183, 293.665, 311.127, 329.628, 349.228, 369.994, 391.995, 415.305, 440, 466.164, 493.883, 523.251, 554.365, 587.33, 622.254, 659.255, 698.456, 739.989, 783.991, 830.609, 880, 932.328, 987.767, 1046.502, 1108.731, 1174.659, 1244.508, 1318.51, 1396.913, 1479.978, 1567.982, 1661.219, 1760, 1864.655, 1975.533, 2093.005, 2217.461, 2349.318, 2489.016, 2637.02, 2793.826, 2959.955, 3135.963, 3322.438, 3520, 3729.31, 3951.066, 4186.009, 4434.922, 4698.636, 4978.032, 5274.041, 5587.652, 5919.911, 6271.927, 6644.875, 7040, 7458.62, 7902.133, 8372.018, 8869.844, 9397.273, 9956.063, 10548.08, 11175.3, 11839.82, 12543.85};
 byte globalNote = 0;
 byte globalVelocity = 0;
@@ -71,6 +168,10 @@ int octave1 = 0;
 int octave2 = 0;
 int octaveSub = -12;
 const float DIV127 = (1.0 / 127.0);
+const float MIXER_HEADROOM = 0.33; // four full sources sum to full scale, limiter1 makes it up
+NoteTracker notes;
+bool legato = false; // glide between held notes without retriggering the envelope
+Glide glide;
 float detuneFactor = 1;
 float bendFactor = 1;
 int bendRange = 12;
@@ -86,77 +187,448 @@ float FILfactor = 1;
 byte osc1Mode = 255; // 255 = Nonsense value to force startup read
 byte osc2Mode = 255;
 
+// Unison and stereo placement
+byte unisonVoices = 1;
+float unisonDetune = 0;      // cents between the outermost voices
+int32_t stereoSpread = 0;    // Q15, pan distance of the outermost voices
+int32_t widthKeyTrack = 0;   // Q15, extra width per octave above middle C
+float unisonRatio[SYNTH_VOICES];
+int32_t unisonPosition[SYNTH_VOICES]; // -32767..32767 across the unison stack
+
+// Parts, part 0 is the lead and owns every channel not given to another part
+Part parts[SYNTH_PARTS];
+byte channelPart[16];
+VoicePool voices;
+byte leadVoice[SYNTH_VOICES];
+byte leadVoices = 0;
+// MPE, per-note expression lands in the per-voice arrays and is folded into
+// the voices once per block by mpeTick()
+MpeZone mpeLower(MPE_LOWER_MASTER);
+MpeZone mpeUpper(MPE_UPPER_MASTER);
+byte mpeChannelVoice[16];
+byte mpeVoiceChannel[SYNTH_VOICES];
+int32_t mpeChannelBend[16];           // cents
+byte mpeChannelPressure[16];
+byte mpeChannelSlide[16];
+int32_t mpeMasterBend = 0;            // cents, the whole zone
+int32_t voiceCents[SYNTH_VOICES];
+int32_t voiceBend[SYNTH_VOICES];
+byte voicePressure[SYNTH_VOICES];
+byte voiceSlide[SYNTH_VOICES];
+volatile byte mpeDirty = 0;           // one bit per voice
+// Velocity and controller response. The note path only reads the depth
+// tables, they are rebuilt whenever a curve or a depth changes.
+const float VOICE_AMPLITUDE = 0.75; // oscillators run at a fixed level, velocity is applied on the bus
+bool voiceGated[SYNTH_VOICES];       // sources running, from note on until the envelope is idle
+ResponseCurve velocityCurve;
+ResponseCurve modCurve;
+ResponseCurve pressureCurve;
+int16_t velocityLevel[CURVE_POINTS];   // Q15
+int16_t velocityCutoff[CURVE_POINTS];  // Q15
+int32_t velocityAmpDepth = 32767;
+int32_t velocityFilterDepth = 0;       // Q15, at most 3/4 of the cutoff
+byte modRoute = ROUTE_LFO;
+byte pressureRoute = ROUTE_OFF;
+byte curveIndex = 0;
+byte voiceVelocity[SYNTH_VOICES];
+// Key to pitch in cents. Two tables, a new tuning is built in the idle one
+// and tuningTick() swaps them between audio blocks.
+const byte FLASH_CHIP_SELECT = 6;
+const uint16_t TUNING_TEXT_MAX = 4096;
+Tuning tuning;
+int32_t tuningTables[2][128];
+volatile byte tuningActive = 0;
+volatile bool tuningPending = false;
+int16_t tuningRequest = -1;           // a CCtuning waiting for the SPI bus or the last swap
+char tuningText[TUNING_TEXT_MAX];
+const byte OSC_WAVES[4] = {DUAL_OSC_SINE, DUAL_OSC_TRIANGLE, DUAL_OSC_SAW, DUAL_OSC_PULSE};
+
+// Sequencing, note output runs in the audio interrupt
+Arpeggiator arp;
+StepSequencer stepSeq;
+byte seqMode = SEQ_MODE_OFF;
+bool seqRecord = false;
+float seqTempo = 120;
+volatile bool seqRetrigger = false;
+
+// External MIDI clock, CCclocksync
+MidiClockSync midiClock;
+bool clockExternal = false;
+const byte SEQ_CLOCK_TICKS = MIDI_CLOCK_PPQN / 4; // sequencer steps are 16ths
+const float LFO_SYNC_BEATS[6] = {0.25, 0.5, 1, 2, 4, 8};
+float lfoSyncBeats = 1;
+
+// FM, CCfmoperator picks the operator the other FM CCs edit
+byte fmOperator = 0;
+
+// CCreverbquality rebuilds the reverb's delay lines, which clears 32 KB, so
+// the control only notes the value and synthControlLoop() applies it
+const byte REVERB_QUALITY_NONE = 255;
+volatile byte reverbQualityPending = REVERB_QUALITY_NONE;
+
+// Presets. The global part of a preset is these CCs' last values, see Preset.h
+const byte presetControls[PRESET_CONTROL_COUNT] = {
+  CCfilterfreq, CClfospeed, CClfodepth, CClfomode, CCbendrange, CCunison, CCunisondetune,
+  CCspread, CCwidthtrack, CCglide, CCglidemode, CClegato, CCpriority, CCenvcurve,
+  CCenvvelocity, CCvelocurve, CCvelamp, CCvelfilter, CCmodroute, CCpressroute,
+  CCreverbquality, CCreverbmix, CCreverbsize, CCreverbdamp, CCchorusmix, CCchorusrate,
+  CCchorusdepth, CCdrive
+};
+// The power on sound, in the same order
+const byte presetControlDefaults[PRESET_CONTROL_COUNT] = {
+  127, 29, 0, 0, 12, 1, 0,
+  0, 0, 0, 0, 0, 0, 64,
+  0, 0, 127, 0, ROUTE_LFO, ROUTE_OFF,
+  7, 25, 76, 38, 0, 13,
+  46, 86
+};
+byte controlValues[128];
+Preset presetPending;                 // waiting for presetTick() to swap it in
+volatile byte presetState = PRESET_IDLE;
+volatile uint32_t presetCycles = 0;   // cost of the last swap, inside the audio interrupt
+PresetBank presetBank;
+int16_t programPending = -1;          // a program change waiting for the SPI bus
+// The flash chip shares the SPI bus with the TFT and the threads can switch
+// in the middle of a transfer, so whoever drives either holds spiBus. The
+// menu and config threads wait for it; loop() only tries, and leaves the
+// flash for a later pass if it is taken.
+Threads::Mutex spiBus;
+// Settings saved from the menu, see ConfigStore.h
+ConfigStore config;
+const byte CONFIG_AMP_ATTACK = 0;
+const byte CONFIG_AMP_DECAY = 1;
+const byte CONFIG_AMP_SUSTAIN = 2;
+const byte CONFIG_AMP_RELEASE = 3;
+const byte CONFIG_MIXER_OSC1 = 4;
+const byte CONFIG_MIXER_OSC2 = 5;
+const byte CONFIG_MIXER_NOISE = 6;
+const byte CONFIG_MIXER_SUB = 7;
+const byte CONFIG_PROGRAM = 8;        // last program change, bank * 128 + program
+// The CC each of the menu's settings goes through, by key
+const byte configControls[8] = {CCattack, CCdecay, CCsustain, CCrelease, CCmixer1, CCmixer2, CCmixer3, CCmixer4};
+byte presetBankSelected = 0;          // CCbankselect, applies to the next program change
+SysexTransfer sysex;                  // preset dump and load, see SysexTransfer.h
+
+// Automation lanes, CCautomation: 0 stop, 1 play, 2 record, 127 clear
+AutomationLanes automation;
+
+// Run time histograms of the control code, see Profile.h
+Profiler profiler;
+
+// Boot timing, micros() at the end of each phase of setup(), see bootReport()
+enum BootPhase {
+  BOOT_START = 0,
+  BOOT_STORAGE,
+  BOOT_GRAPH,
+  BOOT_RESTORE,
+  BOOT_AUDIO,
+  BOOT_MENU,
+  BOOT_USB_HOST,
+  BOOT_PHASES
+};
+const char *const bootPhaseNames[BOOT_PHASES] = {"start", "storage", "graph", "restore", "audio", "menu", "usb host"};
+uint32_t bootMicros[BOOT_PHASES];
+
 void synthSetup();
 void synthLoop();
+void synthMidiLoop();
+void synthControlLoop();
 void myNoteOn(byte channel, byte note, byte velocity);
 void myNoteOff(byte channel, byte note, byte velocity);
 void myPitchBend(byte channel, int bend);
-void keyBuff(byte note, bool playNote);
+bool noteChange(NoteChange change);
 void oscPlay(byte note);
 void oscStop();
 void oscSet();
+void oscPitch();
+void glideTick(uint32_t blockStart);
 void myControlChange(byte channel, byte control, byte value);
+void synthControl(byte part, byte control, byte value);
+void presetStore(Preset &preset, const char *name);
+bool presetRecall(const Preset &preset);
+void presetApply(const Preset &preset);
+void presetTick(uint32_t blockStart);
+void myProgramChange(byte channel, byte program);
+void programLoad();
+void mySystemExclusive(const uint8_t *data, uint16_t length, bool complete);
+void usbSysexSend(const uint8_t *data, uint16_t length);
+void sysexEditStore(Preset &preset);
+void automationTick(uint32_t blockStart);
+void automationApply(byte part, byte control, byte value);
+bool automatable(byte control);
+bool rpnControl(byte control);
+void bootRestore();
+void configMigrate();
+void bootMark(byte phase);
+void bootReport(Print &out);
+void configFromPreset(const Preset &preset);
 void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom);
+void unisonSet();
+int32_t voiceWidth(byte note);
+void leadClaim(byte note);
+void partNoteOn(byte part, byte note, byte velocity);
+void partNoteOff(byte part, byte note);
+void partApply(byte part);
+void voicePatch(byte v, byte part);
+void myAfterTouch(byte channel, byte pressure);
+int32_t voiceGain(byte v, byte part);
+float voiceCutoff(byte v, byte part);
+float envelopeTime(byte value);
+void voiceLevels(byte v, byte part);
+void partLevels(byte part);
+void velocityTables();
+void controllerRoute(byte part, byte route, int32_t amount);
+int32_t keyCents(byte note);
+bool tuningLoad(const char *scale, const char *keyboard);
+void tuningPoll();
+void tuningTick(uint32_t blockStart);
+void voiceGate(byte v, bool on);
+void voiceGateTick(uint32_t blockStart);
+bool mpeMember(byte channel);
+void mpeNoteOn(byte channel, byte note, byte velocity);
+void mpeNoteOff(byte channel, byte note);
+void mpeExpression(byte channel);
+void mpeTick(uint32_t blockStart);
+void filterFrequency(float freq);
+void sequencerTick(uint32_t blockStart);
+void seqNoteOn(byte note, byte velocity);
+void seqNoteOff(byte note);
+void seqModeSet(byte mode);
+uint32_t seqStartTime();
+void myClock();
+void myStart();
+void myContinue();
+void myStop();
 
 void synthSetup() {
-  AudioMemory(120);
+  bootMark(BOOT_START);
+  profiler.begin();
+  SerialFlash.begin(FLASH_CHIP_SELECT);
+  presetBank.begin();
+  config.begin();
+  configMigrate();
+  bootMark(BOOT_STORAGE);
 
   usbMIDI.setHandleControlChange(myControlChange);
   usbMIDI.setHandleNoteOff(myNoteOff);
   usbMIDI.setHandleNoteOn(myNoteOn);
   usbMIDI.setHandlePitchChange(myPitchBend);
+  usbMIDI.setHandleAfterTouchChannel(myAfterTouch);
+  usbMIDI.setHandleClock(myClock);
+  usbMIDI.setHandleStart(myStart);
+  usbMIDI.setHandleContinue(myContinue);
+  usbMIDI.setHandleStop(myStop);
+  usbMIDI.setHandleProgramChange(myProgramChange);
+  usbMIDI.setHandleSystemExclusive(mySystemExclusive);
+  sysex.begin(presetBank, sysexEditStore, presetRecall);
+  sysex.port(SYSEX_PORT_USB, usbSysexSend);
+  sysex.bus(spiBus);
   
-  waveform1.begin(WAVEFORM_SAWTOOTH);
-  waveform1.amplitude(0.75);
-  waveform1.frequency(82.41);
-  waveform1.pulseWidth(0.15);
-
-  waveform2.begin(WAVEFORM_SAWTOOTH);
-  waveform2.amplitude(0.75);
-  waveform2.frequency(123);
-  waveform2.pulseWidth(0.15);
-  
-  waveform3.begin(WAVEFORM_SQUARE);
-  waveform3.amplitude(0.75);
-  waveform3.frequency(123);
-  waveform3.pulseWidth(0.15);
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    byte cord = v * 8;
+    voiceCords[cord++].connect(dualOsc[v], 0, mixer1[v], 0);
+    voiceCords[cord++].connect(dualOsc[v], 1, mixer1[v], 1);
+    voiceCords[cord++].connect(pink1[v], 0, mixer1[v], 2);
+    voiceCords[cord++].connect(waveform3[v], 0, mixer1[v], 3);
+    voiceCords[cord++].connect(mixer1[v], 0, fm1, v);
+    voiceCords[cord++].connect(fm1, v, filter1[v], 0);
+    voiceCords[cord++].connect(filter1[v], 0, envelope1, v);
+    voiceCords[cord++].connect(envelope1, v, voiceBus, v);
 
-  pink1.amplitude(1.0);
+    // Silent until voiceGate() opens them, so idle voices render nothing
+    dualOsc[v].amplitude(0);
+    dualOsc[v].frequency(0, 82.41);
+    dualOsc[v].frequency(1, 123);
+    dualOsc[v].pulseWidth(0, 0.15);
+    dualOsc[v].pulseWidth(1, 0.15);
 
-  mixer1.gain(0, 1.0);
-  mixer1.gain(1, 1.0);
-  mixer1.gain(2, 0.0);
+    waveform3[v].begin(WAVEFORM_SQUARE);
+    waveform3[v].amplitude(0);
+    waveform3[v].frequency(123);
+    waveform3[v].pulseWidth(0.15);
 
-  envelope1.attack(1);
-  envelope1.decay(0);
-  envelope1.sustain(1);
-  envelope1.release(500);
-  
-  amp1.gain(1.0);
+    pink1[v].amplitude(0);
+  }
+
+  for (byte p = 0; p < SYNTH_PARTS; p++) {
+    PartPatch &patch = parts[p].patch;
+    patch.mix[0] = MIXER_HEADROOM;
+    patch.mix[1] = MIXER_HEADROOM;
+    patch.mix[2] = 0.0;
+    patch.mix[3] = MIXER_HEADROOM;   // the sub was at unity before the headroom, like osc1 and osc2
+    patch.attack = 1;
+  }
+  parts[0].budget = SYNTH_VOICES;
+  voices.begin(SYNTH_VOICES, 0);
+  for (byte p = 0; p < SYNTH_PARTS; p++) voices.budget(p, parts[p].budget);
+  for (byte v = 0; v < SYNTH_VOICES; v++) voicePatch(v, 0);
+
+  velocityTables();
+  unisonSet();
+  voiceBus.master(1.0);
+
+  arp.begin(seqNoteOn, seqNoteOff);
+  arp.tempo(seqTempo, 4);
+  stepSeq.begin(seqNoteOn, seqNoteOff);
+  stepSeq.tempo(seqTempo, 4);
+  audioClock.addListener(sequencerTick);
+  audioClock.addListener(glideTick); // after the sequencer so its notes glide in the same block
+  audioClock.addListener(mpeTick);
+  audioClock.addListener(tuningTick);
+  audioClock.addListener(presetTick);
+  audioClock.addListener(automationTick);
+  audioClock.addListener(voiceGateTick);
+  automation.begin(automationApply);
+  tuning.build(tuningTables[0]);
+
+  for (byte c = 0; c < 16; c++) {
+    mpeChannelVoice[c] = VOICE_NONE;
+    mpeChannelSlide[c] = 64;
+  }
 
+  ensemble1.delay(12);
+  limiter1.threshold(1.5);
+  limiter1.knee(0.5);
+  limiter1.releaseTime(150);
+
+  // Effects, LFO, unison and the rest through the same CCs a preset uses
+  for (byte i = 0; i < PRESET_CONTROL_COUNT; i++) {
+    synthControl(0, presetControls[i], presetControlDefaults[i]);
+  }
+  bootMark(BOOT_GRAPH);
+
+  bootRestore();
+  bootMark(BOOT_RESTORE);
+
+  // No blocks until now, so the first thing heard is the restored patch
+  AudioMemory(120);
+  bootMark(BOOT_AUDIO);
+}
+
+// The sound from before power off: the last program, then anything saved
+// from the menu since, on top
+void bootRestore() {
+  static Preset boot;
+  int32_t program = config.get(CONFIG_PROGRAM, -1);
+  if (program >= 0 && presetBank.load(program / PRESET_BANK_SLOTS, program % PRESET_BANK_SLOTS, boot)) {
+    presetApply(boot);
+    presetBankSelected = program / PRESET_BANK_SLOTS;
+  }
+  for (byte key = 0; key < sizeof(configControls); key++) {
+    if (config.has(key)) synthControl(0, configControls[key], config.get(key, 0));
+  }
+}
+
+void bootMark(byte phase) {
+  if (phase < BOOT_PHASES) bootMicros[phase] = micros();
+}
+
+// Milliseconds spent in each phase of setup(), and the total to the first block of audio
+void bootReport(Print &out) {
+  for (byte phase = BOOT_STORAGE; phase < BOOT_PHASES; phase++) {
+    out.printf("boot %-9s %4lu.%lu ms\n", bootPhaseNames[phase],
+               (bootMicros[phase] - bootMicros[phase - 1]) / 1000,
+               (bootMicros[phase] - bootMicros[phase - 1]) / 100 % 10);
+  }
+  out.printf("boot to audio %lu ms\n", (bootMicros[BOOT_AUDIO] - bootMicros[BOOT_START]) / 1000);
 }
 
 void synthLoop() {
+  synthMidiLoop();
+  synthControlLoop();
+}
+
+void synthMidiLoop() {
   usbMIDI.read();
-  LFOupdate(false, LFOmodeSelect, FILfactor, LFOdepth);
+  sysex.poll();
+}
+
+void synthControlLoop() {
+  midiClock.poll(audioClock.samplesNow());
+  {
+    ProfileScope scope(profiler, PROFILE_LFO);
+    LFOupdate(seqRetrigger, LFOmodeSelect, FILfactor, LFOdepth);
+  }
+  seqRetrigger = false;
+  programLoad();
+  tuningPoll();
+
+  if (reverbQualityPending != REVERB_QUALITY_NONE) {
+    AudioNoInterrupts();
+    byte quality = reverbQualityPending;
+    reverbQualityPending = REVERB_QUALITY_NONE;
+    AudioInterrupts();
+    reverb1.quality(2 << (quality / 5), quality % 5);
+  }
 }
 
 void myNoteOn(byte channel, byte note, byte velocity) {
+  if (keyCents(note) == TUNING_UNMAPPED) return;
+  if (mpeMember(channel)) {
+    mpeNoteOn(channel, note, velocity);
+    return;
+  }
+  byte part = channelPart[(channel - 1) & 15];
+  if (part != 0) {
+    partNoteOn(part, note, velocity);
+    return;
+  }
+  if (seqMode == SEQ_MODE_ARP) {
+    AudioNoInterrupts();
+    if (arp.heldCount() == 0) arp.start(seqStartTime());
+    arp.noteOn(note, velocity);
+    AudioInterrupts();
+    return;
+  }
+  if (seqMode == SEQ_MODE_STEP) {
+    AudioNoInterrupts();
+    if (seqRecord) stepSeq.record(note, velocity);
+    else stepSeq.transpose(note - 60);
+    AudioInterrupts();
+    return;
+  }
+
   if ( note > 23 && note < 108 ) {
-    globalNote = note;
-    globalVelocity = velocity;
-    keyBuff(note, true);
-    LFOupdate(true, LFOmodeSelect, FILfactor, LFOdepth);
+    if (noteChange(notes.press(note, velocity))) {
+      LFOupdate(true, LFOmodeSelect, FILfactor, LFOdepth);
+    }
   }
 }
 
 void myNoteOff(byte channel, byte note, byte velocity) {
+  if (mpeMember(channel)) {
+    mpeNoteOff(channel, note);
+    return;
+  }
+  byte part = channelPart[(channel - 1) & 15];
+  if (part != 0) {
+    partNoteOff(part, note);
+    return;
+  }
+  if (seqMode == SEQ_MODE_ARP) {
+    AudioNoInterrupts();
+    arp.noteOff(note);
+    AudioInterrupts();
+    return;
+  }
+  if (seqMode == SEQ_MODE_STEP) return;
+
   if ( note > 23 && note < 108 ) {
-    keyBuff(note, false);
+    noteChange(notes.release(note));
   }
 }
 
 void myPitchBend(byte channel, int bend) {
+  if (mpeMember(channel)) {
+    mpeChannelBend[(channel - 1) & 15] = (mpeLower.member(channel) ? mpeLower : mpeUpper).bendCents(channel, bend);
+    mpeExpression(channel);
+    return;
+  }
+  if (mpeLower.master(channel) || mpeUpper.master(channel)) {
+    mpeMasterBend = (mpeLower.master(channel) ? mpeLower : mpeUpper).bendCents(channel, bend);
+    mpeDirty = 0xFF; // zone wide, the lead below follows it too
+  }
+  if (channelPart[(channel - 1) & 15] != 0) return; // lead only
   float bendF = bend;
   bendF = bendF / 8192;
   bendF = bendF * bendRange;
@@ -166,176 +638,775 @@ void myPitchBend(byte channel, int bend) {
 }
 
 
-void keyBuff(byte note, bool playNote) {
-  static byte buff[BUFFER];
-  static byte buffSize = 0;
-
-  // Add Note
-  if (playNote == true && (buffSize < BUFFER) ) {
-    oscPlay(note);
-    buff[buffSize] = note;
-    buffSize++;
-    return;
+// Follow the note tracker, true when the envelope was retriggered
+bool noteChange(NoteChange change) {
+  if (change == NOTE_SAME) return false;
+  if (change == NOTE_STOP) {
+    oscStop();
+    return false;
   }
 
-  // Remove Note
-  else if (playNote == false && buffSize != 0) {
-    for (byte found = 0; found < buffSize; found++) {
-      if (buff[found] == note) {
-        for (byte gap = found; gap < (buffSize - 1); gap++) {
-          buff[gap] = buff[gap + 1];
-        }
-        buffSize--;
-        buff[buffSize] = 255;
-        if (buffSize != 0) {
-          oscPlay(buff[buffSize - 1]);
-          return;
-        }
-        else {
-          oscStop();
-          return;
-        }
-      }
-    }
+  globalNote = notes.note();
+  globalVelocity = notes.velocity();
+  AudioNoInterrupts();
+  glide.target(keyCents(globalNote), change == NOTE_MOVE);
+  AudioInterrupts();
+  if (change == NOTE_MOVE && legato) {
+    oscSet();
+    return false;
   }
+  oscPlay(globalNote);
+  return true;
 }
 
 void oscPlay(byte note) {
-  waveform1.frequency(noteFreqs[note + octave1] * bendFactor * LFOpitch);
-  waveform2.frequency(noteFreqs[note + octave2] * detuneFactor * bendFactor * LFOpitch);
-  waveform3.frequency(noteFreqs[note + octave1 + octaveSub] * bendFactor * LFOpitch); // always play one octave below waveform1
-  
-  float velo = 0.75 * (globalVelocity * DIV127);//TEST velocity limit to 0.75
-  waveform1.amplitude(velo);
-  waveform2.amplitude(velo);
-  waveform3.amplitude(velo);
-  pink1.amplitude(velo);
-  //envelope1.releaseNoteOn(5);//TEST
-  envelope1.noteOn();
+  int32_t width = voiceWidth(note);
+
+  AudioNoInterrupts(); // the sequencer plays the lead from the audio interrupt
+  leadClaim(note);
+  oscPitch();
+  for (byte u = 0; u < leadVoices; u++) {
+    byte v = leadVoice[u];
+    voiceVelocity[v] = globalVelocity;
+    voiceLevels(v, 0);
+    voiceBus.pan(v, (unisonPosition[u] * width) >> 15);
+    voiceGate(v, true);
+    envelope1.noteOn(v, voiceVelocity[v]);
+    fm1.noteOn(v);
+  }
+  AudioInterrupts();
 }
 
 void oscStop() {
-  envelope1.noteOff();
+  AudioNoInterrupts();
+  for (byte u = 0; u < leadVoices; u++) {
+    byte v = leadVoice[u];
+    if (voices.owner(v) != 0) continue; // taken by another part
+    envelope1.noteOff(v);
+    fm1.noteOff(v);
+    voices.release(v);
+  }
+  AudioInterrupts();
+}
+
+// Take the voices for a lead note, usually the ones it played last time
+void leadClaim(byte note) {
+  for (byte u = 0; u < leadVoices; u++) {
+    if (voices.owner(leadVoice[u]) == 0) voices.release(leadVoice[u]);
+  }
+  leadVoices = 0;
+  for (byte u = 0; u < unisonVoices && u < parts[0].budget; u++) {
+    byte v = voices.allocate(0);
+    if (v == VOICE_NONE) break;
+    if (voices.owner(v) != 0) voicePatch(v, 0);
+    voices.hold(v, 0, note);
+    leadVoice[leadVoices++] = v;
+  }
 }
 
 void oscSet() {
-  waveform1.frequency(noteFreqs[globalNote + octave1] * bendFactor * LFOpitch);
-  waveform2.frequency(noteFreqs[globalNote + octave2] * detuneFactor * bendFactor * LFOpitch);
-  waveform3.frequency(noteFreqs[globalNote + octave1 + octaveSub] * bendFactor * LFOpitch); // always play one octave below waveform1
+  AudioNoInterrupts(); // the sequencer may change globalNote from the audio interrupt
+  oscPitch();
+  AudioInterrupts();
+}
+
+// Retune the active voices from the glide pitch, three table lookups in all
+void oscPitch() {
+  int32_t cents = glide.cents();
+  float mod = bendFactor * LFOpitch;
+  float freq1 = centsToHz(cents + octave1 * 100) * mod;
+  float freq2 = centsToHz(cents + octave2 * 100) * detuneFactor * mod;
+  float freqSub = centsToHz(cents + (octave1 + octaveSub) * 100) * mod; // always play one octave below osc1
+  for (byte u = 0; u < leadVoices; u++) {
+    byte v = leadVoice[u];
+    if (voices.owner(v) != 0) continue;
+    dualOsc[v].frequency(0, freq1 * unisonRatio[u]);
+    fm1.frequency(v, freq1 * unisonRatio[u]);
+    dualOsc[v].frequency(1, freq2 * unisonRatio[u]);
+    waveform3[v].frequency(freqSub * unisonRatio[u]);
+  }
+}
+
+// Audio interrupt, only touches the oscillators while a glide is moving
+void glideTick(uint32_t blockStart) {
+  if (!glide.moving()) return;
+  glide.step();
+  oscPitch();
+}
+
+// Spread the lead's voices evenly from left to right and detune them
+// symmetrically around the played pitch. Spare voices go back to the pool.
+void unisonSet() {
+  for (byte u = 0; u < SYNTH_VOICES; u++) {
+    int32_t position = 0;
+    if (unisonVoices > 1 && u < unisonVoices) {
+      position = ((2 * u - (unisonVoices - 1)) * 32767) / (unisonVoices - 1);
+    }
+    unisonPosition[u] = position;
+    unisonRatio[u] = pow(2, (unisonDetune * 0.5 * (position / 32767.0)) / 1200.0);
+  }
+
+  AudioNoInterrupts();
+  for (byte u = unisonVoices; u < leadVoices; u++) {
+    byte v = leadVoice[u];
+    if (voices.owner(v) != 0) continue;
+    envelope1.noteOff(v);
+    fm1.noteOff(v);
+    voices.release(v);
+  }
+  if (leadVoices > unisonVoices) leadVoices = unisonVoices;
+  AudioInterrupts();
+}
+
+// Stereo width for a note, the spread widens (or narrows) with pitch
+int32_t voiceWidth(byte note) {
+  int32_t width = stereoSpread + ((((stereoSpread * widthKeyTrack) >> 15) * ((int)note - 60)) / 12);
+  if (width < 0) width = 0;
+  if (width > 32767) width = 32767;
+  return width;
+}
+
+// Lead filter, also the cutoff a voice gets when the lead takes it back
+void filterFrequency(float freq) {
+  parts[0].patch.cutoff = freq;
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    if (voices.owner(v) != 0) continue;
+    if (mpeChannelVoice[(mpeVoiceChannel[v] - 1) & 15] == v) continue; // slide has it
+    filter1[v].frequency(voiceCutoff(v, 0));
+  }
+}
+
+// Load a part's patch into one voice
+void voicePatch(byte v, byte part) {
+  const PartPatch &patch = parts[part].patch;
+  dualOsc[v].begin(0, patch.wave1);
+  dualOsc[v].begin(1, patch.wave2);
+  dualOsc[v].sync(patch.sync);
+  dualOsc[v].ring(patch.ring);
+  for (byte i = 0; i < 4; i++) mixer1[v].gain(i, patch.mix[i]);
+  filter1[v].resonance(patch.resonance);
+  envelope1.attack(v, patch.attack);
+  envelope1.decay(v, patch.decay);
+  envelope1.sustain(v, patch.sustain);
+  envelope1.releaseTime(v, patch.release);
+  fm1.algorithm(v, patch.fmAlgorithm);
+  fm1.feedback(v, patch.fmFeedback);
+  for (byte op = 0; op < FM_OPERATORS; op++) {
+    fm1.ratio(v, op, patch.fmRatio[op]);
+    fm1.level(v, op, patch.fmLevel[op]);
+    fm1.envelope(v, op, patch.fmAttack[op], patch.fmDecay[op], patch.fmSustain[op], patch.fmRelease[op]);
+  }
+  voiceLevels(v, part);
+}
+
+// Envelope times are heard logarithmically, 1ms to 10s across the CC range
+float envelopeTime(byte value) {
+  return pow(10000, value * DIV127);
+}
+
+// Bus level for a voice: part level, velocity and expression, all Q15
+int32_t voiceGain(byte v, byte part) {
+  const Part &p = parts[part];
+  return mulQ15(mulQ15(p.level, velocityLevel[voiceVelocity[v]]), p.expression);
+}
+
+float voiceCutoff(byte v, byte part) {
+  const Part &p = parts[part];
+  return p.patch.cutoff * p.brightness * (velocityCutoff[voiceVelocity[v]] * (1.0f / 32768.0f));
+}
+
+void voiceLevels(byte v, byte part) {
+  voiceBus.level(v, voiceGain(v, part));
+  filter1[v].frequency(voiceCutoff(v, part));
+}
+
+// After a part's level or a controller moved
+void partLevels(byte part) {
+  AudioNoInterrupts();
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    if (voices.owner(v) == part) voiceLevels(v, part);
+  }
+  AudioInterrupts();
+}
+
+void velocityTables() {
+  velocityCurve.depthTable(velocityLevel, velocityAmpDepth);
+  velocityCurve.depthTable(velocityCutoff, velocityFilterDepth);
+}
+
+// Mod wheel or aftertouch, amount is Q15 from its response curve
+void controllerRoute(byte part, byte route, int32_t amount) {
+  switch (route) {
+    case ROUTE_LEVEL: // swells from half level
+      parts[part].expression = 16384 + (amount >> 1);
+      partLevels(part);
+      break;
+    case ROUTE_CUTOFF:
+      parts[part].brightness = 0.25 + 1.5 * (amount * (1.0f / 32768.0f));
+      partLevels(part);
+      break;
+    case ROUTE_LFO:
+      LFOdepth = amount * (1.0f / 32768.0f);
+      break;
+  }
+}
+
+// Reload the patch into every voice the part owns after an edit
+void partApply(byte part) {
+  AudioNoInterrupts();
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    if (voices.owner(v) == part) voicePatch(v, part);
+  }
+  AudioInterrupts();
+}
+
+// Parts 1-3, one voice per note at the part's own pan and level
+void partNoteOn(byte part, byte note, byte velocity) {
+  const PartPatch &patch = parts[part].patch;
+  int32_t cents = keyCents(note);
+
+  AudioNoInterrupts();
+  byte v = voices.allocate(part);
+  if (v != VOICE_NONE) {
+    if (voices.owner(v) != part) voicePatch(v, part);
+    voices.hold(v, part, note);
+    dualOsc[v].frequency(0, centsToHz(cents));
+    fm1.frequency(v, centsToHz(cents));
+    dualOsc[v].frequency(1, centsToHz(cents + patch.octave2 * 100) * patch.detune);
+    waveform3[v].frequency(centsToHz(cents + octaveSub * 100));
+    voiceVelocity[v] = velocity;
+    voiceLevels(v, part);
+    voiceBus.pan(v, parts[part].pan);
+    voiceGate(v, true);
+    envelope1.noteOn(v, voiceVelocity[v]);
+    fm1.noteOn(v);
+  }
+  AudioInterrupts();
+}
+
+void partNoteOff(byte part, byte note) {
+  AudioNoInterrupts();
+  byte v = voices.find(part, note);
+  if (v != VOICE_NONE) {
+    envelope1.noteOff(v);
+    fm1.noteOff(v);
+    voices.release(v);
+  }
+  AudioInterrupts();
+}
+
+void myAfterTouch(byte channel, byte pressure) {
+  if (!mpeMember(channel)) {
+    controllerRoute(channelPart[(channel - 1) & 15], pressureRoute, pressureCurve.lookup(pressure));
+    return;
+  }
+  mpeChannelPressure[(channel - 1) & 15] = pressure;
+  mpeExpression(channel);
+}
+
+bool mpeMember(byte channel) {
+  return mpeLower.member(channel) || mpeUpper.member(channel);
+}
+
+// One note per member channel, played with the lead's patch. Expression
+// sent before the note on is already in the channel state and applies at once.
+void mpeNoteOn(byte channel, byte note, byte velocity) {
+  byte c = (channel - 1) & 15;
+
+  AudioNoInterrupts();
+  byte v = voices.allocate(0);
+  if (v != VOICE_NONE) {
+    if (voices.owner(v) != 0) voicePatch(v, 0);
+    voices.hold(v, 0, note);
+    mpeChannelVoice[c] = v;
+    mpeVoiceChannel[v] = channel;
+    voiceCents[v] = keyCents(note);
+    voiceVelocity[v] = velocity;
+    voiceBus.pan(v, parts[0].pan);
+    voiceBend[v] = mpeChannelBend[c];
+    voicePressure[v] = mpeChannelPressure[c];
+    voiceSlide[v] = mpeChannelSlide[c];
+    mpeDirty |= (1 << v);
+    mpeTick(0); // tune it now rather than a block late
+    voiceGate(v, true);
+    envelope1.noteOn(v, voiceVelocity[v]);
+    fm1.noteOn(v);
+  }
+  AudioInterrupts();
+}
+
+void mpeNoteOff(byte channel, byte note) {
+  byte c = (channel - 1) & 15;
+  AudioNoInterrupts();
+  byte v = mpeChannelVoice[c];
+  if (v != VOICE_NONE && voices.owner(v) == 0 && voices.held(v) && voices.note(v) == note && mpeVoiceChannel[v] == channel) {
+    envelope1.noteOff(v);
+    fm1.noteOff(v);
+    voices.release(v);
+  }
+  mpeChannelVoice[c] = VOICE_NONE;
+  mpeChannelBend[c] = 0;
+  mpeChannelPressure[c] = 0;
+  mpeChannelSlide[c] = 64;
+  AudioInterrupts();
+}
+
+// Copy a member channel's expression to its voice, applied on the next block
+void mpeExpression(byte channel) {
+  byte c = (channel - 1) & 15;
+  byte v = mpeChannelVoice[c];
+  if (v == VOICE_NONE) return;
+  AudioNoInterrupts();
+  voiceBend[v] = mpeChannelBend[c];
+  voicePressure[v] = mpeChannelPressure[c];
+  voiceSlide[v] = mpeChannelSlide[c];
+  mpeDirty |= (1 << v);
+  AudioInterrupts();
+}
+
+// Audio interrupt. However many bend, pressure and slide messages came in,
+// each voice is retuned and rebalanced at most once per block.
+void mpeTick(uint32_t blockStart) {
+  byte dirty = mpeDirty;
+  if (!dirty) return;
+  mpeDirty = 0;
+
+  const PartPatch &patch = parts[0].patch;
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    if (!(dirty & (1 << v))) continue;
+    byte channel = mpeVoiceChannel[v];
+    if (voices.owner(v) != 0 || mpeChannelVoice[(channel - 1) & 15] != v) continue;
+
+    int32_t cents = voiceCents[v] + voiceBend[v] + mpeMasterBend;
+    float freq1 = centsToHz(cents + octave1 * 100);
+    dualOsc[v].frequency(0, freq1);
+    fm1.frequency(v, freq1);
+    dualOsc[v].frequency(1, centsToHz(cents + patch.octave2 * 100) * patch.detune);
+    waveform3[v].frequency(centsToHz(cents + (octave1 + octaveSub) * 100));
+
+    // Pressure swells the voice from half level, slide opens the filter
+    voiceBus.level(v, (voiceGain(v, 0) * (127 + voicePressure[v])) / 254);
+    filter1[v].frequency(voiceCutoff(v, 0) * (0.25 + 1.5 * (voiceSlide[v] * DIV127)));
+  }
+}
+
+// Audio interrupt, once per block before any voice is rendered
+void sequencerTick(uint32_t blockStart) {
+  arp.tick(blockStart, AUDIO_BLOCK_SAMPLES);
+  stepSeq.tick(blockStart, AUDIO_BLOCK_SAMPLES);
+}
+
+// Audio interrupt
+void seqNoteOn(byte note, byte velocity) {
+  if (note + octaveSub < 0 || note + octave2 > 127) return;
+  if (keyCents(note) == TUNING_UNMAPPED) return;
+  globalNote = note;
+  globalVelocity = velocity;
+  glide.target(keyCents(note), false);
+  oscPlay(note);
+  seqRetrigger = true;
+}
+
+// Audio interrupt
+void seqNoteOff(byte note) {
+  if (note == globalNote) oscStop();
+}
+
+void seqModeSet(byte mode) {
+  AudioNoInterrupts();
+  arp.stop();
+  arp.clear();
+  stepSeq.stop();
+  if (mode == SEQ_MODE_STEP && (!clockExternal || midiClock.running())) stepSeq.start(seqStartTime());
+  AudioInterrupts();
+  if (mode != seqMode) {
+    oscStop();
+    notes.clear();
+  }
+  seqMode = mode;
+}
+
+int32_t keyCents(byte note) {
+  return tuningTables[tuningActive][note & 127];
+}
+
+// The tuning CCtuning asked for: 0 is equal temperament, n loads tuning<n>.scl
+// and tuning<n>.kbm. Also from synthControlLoop(), until no SysEx transfer is
+// writing flash, the bus is free and the last table has been swapped in.
+void tuningPoll() {
+  if (tuningRequest < 0 || tuningPending || sysex.busy() || !spiBus.try_lock()) return;
+  byte value = tuningRequest;
+  tuningRequest = -1;
+  if (value == 0) {
+    tuningLoad(NULL, NULL);
+  } else {
+    char scale[16];
+    char keyboard[16];
+    sprintf(scale, "tuning%d.scl", value);
+    sprintf(keyboard, "tuning%d.kbm", value);
+    tuningLoad(scale, keyboard);
+  }
+  spiBus.unlock();
+}
+
+// Read a .scl (and optionally a .kbm) from flash and build the idle table.
+// Notes already sounding keep their pitch, new ones use the new tuning.
+// Call with spiBus held. Refused while the last swap has not happened yet.
+bool tuningLoad(const char *scale, const char *keyboard) {
+  if (tuningPending) return false;
+
+  static Tuning next; // too big for the menu thread's stack
+  next.equal();
+  if (scale) {
+    SerialFlashFile file = SerialFlash.open(scale);
+    if (!file) return false;
+    uint32_t length = file.size();
+    if (length >= TUNING_TEXT_MAX) length = TUNING_TEXT_MAX - 1;
+    file.read(tuningText, length);
+    file.close();
+    tuningText[length] = 0;
+    if (!next.scale(tuningText)) return false;
+  }
+  if (keyboard && SerialFlash.exists(keyboard)) {
+    SerialFlashFile file = SerialFlash.open(keyboard);
+    uint32_t length = file.size();
+    if (length >= TUNING_TEXT_MAX) length = TUNING_TEXT_MAX - 1;
+    file.read(tuningText, length);
+    file.close();
+    tuningText[length] = 0;
+    if (!next.keyboard(tuningText)) return false;
+  }
+
+  next.build(tuningTables[tuningActive ^ 1]);
+  tuning = next;
+  tuningPending = true;
+  return true;
+}
+
+// Called with the audio interrupt held off, like the envelope's noteOn() that follows it
+void voiceGate(byte v, bool on) {
+  float level = on ? VOICE_AMPLITUDE : 0;
+  dualOsc[v].amplitude(level);
+  waveform3[v].amplitude(level);
+  pink1[v].amplitude(level);
+  voiceGated[v] = on;
+}
+
+// Audio interrupt. A voice whose release has ended stops its sources, so
+// the oscillators and the noise cost nothing at rest.
+void voiceGateTick(uint32_t blockStart) {
+  for (byte v = 0; v < SYNTH_VOICES; v++) {
+    if (voiceGated[v] && !envelope1.isActive(v)) voiceGate(v, false);
+  }
+}
+
+// Audio interrupt, the only place the active table changes
+void tuningTick(uint32_t blockStart) {
+  if (!tuningPending) return;
+  tuningActive ^= 1;
+  tuningPending = false;
+}
+
+// Next step boundary: now on the internal clock, the next 16th on the grid
+// when following a locked MIDI clock
+uint32_t seqStartTime() {
+  if (clockExternal && midiClock.locked()) return midiClock.nextStepSample(SEQ_CLOCK_TICKS);
+  return audioClock.samples();
+}
+
+// 0xF8, 24 per quarter note
+void myClock() {
+  midiClock.tick(audioClock.samplesNow());
+  if (!clockExternal || !midiClock.locked()) return;
+
+  uint32_t ticks = midiClock.ticks();
+  uint32_t stepQ8 = (midiClock.samplesPerTickQ16() * SEQ_CLOCK_TICKS) >> 8;
+
+  AudioNoInterrupts();
+  arp.stepLength(stepQ8);
+  stepSeq.stepLength(stepQ8);
+  automation.align(ticks * (AUTOMATION_PPQN / MIDI_CLOCK_PPQN));
+  if (ticks % SEQ_CLOCK_TICKS == 0) {
+    uint32_t stepTime = midiClock.nextTickSample();
+    arp.align(stepTime);
+    stepSeq.align(stepTime);
+  }
+  AudioInterrupts();
+
+  // Once a beat is plenty for the LFO, it only needs the rate
+  if (ticks % MIDI_CLOCK_PPQN == 0) {
+    float beatMicros = 60000000.0 / midiClock.bpm();
+    LFOspeed = (beatMicros * lfoSyncBeats) / 200; // 200 LFO steps per cycle
+  }
+}
+
+// 0xFA, restart the step sequencer on the first tick of the song
+void myStart() {
+  midiClock.start();
+  if (!clockExternal) return;
+  automation.restart();
+  AudioNoInterrupts();
+  if (seqMode == SEQ_MODE_STEP) stepSeq.start(midiClock.locked() ? midiClock.nextTickSample() : audioClock.samples());
+  AudioInterrupts();
+}
+
+// 0xFB, song position is not tracked so carry on from the next 16th
+void myContinue() {
+  midiClock.resume();
+  if (!clockExternal) return;
+  AudioNoInterrupts();
+  if (seqMode == SEQ_MODE_STEP && !stepSeq.running()) stepSeq.start(seqStartTime());
+  AudioInterrupts();
+}
+
+// 0xFC
+void myStop() {
+  midiClock.stop();
+  if (!clockExternal) return;
+  AudioNoInterrupts();
+  stepSeq.stop();
+  arp.stop();
+  AudioInterrupts();
 }
 
 void myControlChange(byte channel, byte control, byte value) {
-  
-  float gainLimit = 1.0;
+  mpeLower.controlChange(channel, control, value);
+  mpeUpper.controlChange(channel, control, value);
+  if (rpnControl(control)) return;
+  if (control == 74 && mpeMember(channel)) {
+    mpeChannelSlide[(channel - 1) & 15] = value;
+    mpeExpression(channel);
+    return;
+  }
+  if (control == CCpartchannel) { // gives the channel this arrives on to part 0-3
+    if (value < SYNTH_PARTS) channelPart[(channel - 1) & 15] = value;
+    return;
+  }
+  if (control == CCbankselect) { // MSB only, the LSB (32) is ignored
+    if (value < PRESET_BANKS) presetBankSelected = value;
+    return;
+  }
+  byte part = channelPart[(channel - 1) & 15];
+  if (automatable(control)) automation.input(part, control, value);
+  synthControl(part, control, value);
+}
+
+// Data entry, increment/decrement and the RPN/NRPN selects belong to the
+// parameter numbers, MPE configuration and bend range included, never to a
+// synth control
+bool rpnControl(byte control) {
+  return control == 6 || control == 38 || (control >= 96 && control <= 101);
+}
+
+// Lanes replay from the audio interrupt, so only sound parameters that cost a
+// few float ops and a pass over the voices are recorded. Anything that reads
+// flash, clears a buffer, reallocates voices or changes the transport is not.
+bool automatable(byte control) {
   switch (control) {
     case CCmixer1:
-      mixer1.gain(0, gainLimit * (value * DIV127)); //TEST gain limit to 0.3
+    case CCmixer2:
+    case CCmixer3:
+    case CCmixer4:
+    case CCfilterfreq:
+    case CCfilterres:
+    case CCattack:
+    case CCdecay:
+    case CCsustain:
+    case CCrelease:
+    case CClfospeed:
+    case CClfodepth:
+    case CClfomode:
+    case CCreverbmix:
+    case CCreverbsize:
+    case CCreverbdamp:
+    case CCchorusmix:
+    case CCchorusrate:
+    case CCchorusdepth:
+    case CCdrive:
+    case CCringmod:
+    case CCmodwheel:
+    case CCpartlevel:
+    case CCpartpan:
+      return true;
+  }
+  return false;
+}
+
+// Audio interrupt, after the sequencer so its steps and the lanes share a clock
+void automationTick(uint32_t blockStart) {
+  automation.tick(AUDIO_BLOCK_SAMPLES, arp.stepLength(), AUTOMATION_PPQN / 4);
+}
+
+// Audio interrupt, once per lane per block at most
+void automationApply(byte part, byte control, byte value) {
+  synthControl(part, control, value);
+}
+
+// Everything a CC can change, for one part. Also how presets set the globals.
+void synthControl(byte part, byte control, byte value) {
+  if (part == 0 || control != CCfilterfreq) controlValues[control & 127] = value;
+
+  float gainLimit = MIXER_HEADROOM;
+  PartPatch &patch = parts[part].patch;
+  switch (control) {
+    case CCmixer1:
+      patch.mix[0] = gainLimit * (value * DIV127);
+      partApply(part);
       break;
 
     case CCmixer2:
-      mixer1.gain(1, gainLimit * (value * DIV127));
+      patch.mix[1] = gainLimit * (value * DIV127);
+      partApply(part);
       break;
 
     case CCmixer3:
-      mixer1.gain(2, gainLimit * (value * DIV127));
+      patch.mix[2] = gainLimit * (value * DIV127);
+      partApply(part);
       break;
 
     case CCmixer4:
-      mixer1.gain(3, gainLimit * (value * DIV127));
+      patch.mix[3] = gainLimit * (value * DIV127);
+      partApply(part);
       break;
 
     case CCoctave:
-      switch (value) {
-        case 0:
-          octave2 = 24;
-          break;
-        case 1:
-          octave2 = 12;
-          break;
-        case 2:
-          octave2 = 0;
-          break;
-        case 3:
-          octave2 = -12;
-          break;
-        case 4:
-          octave2 = -24;
-          break;
+      if (value <= 4) {
+        patch.octave2 = 24 - (12 * value);
+        if (part == 0) {
+          octave2 = patch.octave2;
+          oscSet();
+        }
       }
-      oscSet();
       break;
 
     case CCattack:
-      envelope1.attack((3000 * (value * DIV127)) + 10.5);//TEST Attack min limit to 10.5ms
+      patch.attack = envelopeTime(value);
+      partApply(part);
       break;
 
     case CCdecay:
-      envelope1.decay(3000 * (value * DIV127));
+      patch.decay = envelopeTime(value);
+      partApply(part);
+      break;
+
+    case CCenvcurve:
+      envelope1.curve(value * DIV127);
+      break;
+
+    case CCenvvelocity:
+      envelope1.velocityTime(value * DIV127);
       break;
 
     case CCsustain:
-      envelope1.sustain(value * DIV127);
+      patch.sustain = value * DIV127;
+      partApply(part);
       break;
 
     case CCrelease:
-      envelope1.release(3000 * (value * DIV127));
+      patch.release = envelopeTime(value);
+      partApply(part);
       break;
 
     case CCosc1:
-      switch (value) {
-        case 0:
-          waveform1.begin(WAVEFORM_SINE);
-          osc1Mode = 0;
-          break;
-        case 1:
-          waveform1.begin(WAVEFORM_TRIANGLE);
-          osc1Mode = 1;
-          break;
-        case 2:
-          waveform1.begin(WAVEFORM_SAWTOOTH);
-          osc1Mode = 2;
-          break;
-        case 3:
-          waveform1.begin(WAVEFORM_PULSE);
-          osc1Mode = 3;
-          break;
+      if (value <= 3) {
+        patch.wave1 = OSC_WAVES[value];
+        partApply(part);
+        if (part == 0) osc1Mode = value;
       }
       break;
 
     case CCosc2:
-      switch (value) {
-        case 0:
-          waveform2.begin(WAVEFORM_SINE);
-          osc2Mode = 0;
-          break;
-        case 1:
-          waveform2.begin(WAVEFORM_TRIANGLE);
-          osc2Mode = 1;
-          break;
-        case 2:
-          waveform2.begin(WAVEFORM_SAWTOOTH);
-          osc2Mode = 2;
-          break;
-        case 3:
-          waveform2.begin(WAVEFORM_PULSE);
-          osc2Mode = 3;
-          break;
+      if (value <= 3) {
+        patch.wave2 = OSC_WAVES[value];
+        partApply(part);
+        if (part == 0) osc2Mode = value;
       }
       break;
 
     case CCdetune:
-      detuneFactor = 1 - (0.05 * (value * DIV127));
-      oscSet();
+      patch.detune = 1 - (0.05 * (value * DIV127));
+      if (part == 0) {
+        detuneFactor = patch.detune;
+        oscSet();
+      }
       break;
 
     case CCfilterfreq:
+      if (part != 0) {
+        patch.cutoff = 10000 * (value * DIV127);
+        partApply(part);
+        break;
+      }
       FILfactor = value * DIV127;
       FILfreq = 10000 * (value * DIV127);
-      if (LFOmodeSelect < 1 || LFOmodeSelect > 5)filter1.frequency(FILfreq);
+      if (LFOmodeSelect < 1 || LFOmodeSelect > 5)filterFrequency(FILfreq);
       break;
 
     case CCfilterres:
-      filter1.resonance((4.3 * (value * DIV127)) + 0.7);
+      patch.resonance = (4.3 * (value * DIV127)) + 0.7;
+      partApply(part);
+      break;
+
+    case CCpartvoices:
+      if (value >= 1 && value <= SYNTH_VOICES) {
+        parts[part].budget = value;
+        AudioNoInterrupts();
+        voices.budget(part, value);
+        AudioInterrupts();
+      }
+      break;
+
+    case CCpartlevel:
+      parts[part].level = (value * 32767) / 127;
+      partLevels(part);
+      break;
+
+    case CCmodwheel:
+      controllerRoute(part, modRoute, modCurve.lookup(value));
+      break;
+
+    case CCvelocurve: // 0 linear, 1 soft, 2 hard, 3 fixed, 4 user
+      if (value <= CURVE_USER) {
+        velocityCurve.shape((ResponseShape)value);
+        velocityTables();
+      }
+      break;
+
+    case CCvelamp:
+      velocityAmpDepth = (value * 32767) / 127;
+      velocityTables();
+      break;
+
+    case CCvelfilter:
+      velocityFilterDepth = (value * 24575) / 127;
+      velocityTables();
+      break;
+
+    case CCmodroute:
+      if (value <= ROUTE_LFO) modRoute = value;
+      break;
+
+    case CCpressroute:
+      if (value <= ROUTE_LFO) pressureRoute = value;
+      break;
+
+    case CCtuning: // 0 is equal temperament, n loads tuning<n>.scl and tuning<n>.kbm
+      tuningRequest = value;
+      tuningPoll();
+      break;
+
+    case CCcurveindex: // then CCcurvevalue draws the user curve point by point
+      curveIndex = value;
+      break;
+
+    case CCcurvevalue:
+      velocityCurve.point(curveIndex, value);
+      curveIndex = (curveIndex + 1) & 127;
+      if (velocityCurve.shape() == CURVE_USER) velocityTables();
+      break;
+
+    case CCpartpan: // parts 1-3, the lead is placed by CCspread
+      parts[part].pan = ((value - 64) * 32767) / 63;
       break;
 
     case CCbendrange:
@@ -349,6 +1420,7 @@ void myControlChange(byte channel, byte control, byte value) {
         float xSpeed = value * DIV127;
         xSpeed = pow(100, (xSpeed - 1));
         LFOspeed = (70000 * xSpeed);
+        lfoSyncBeats = LFO_SYNC_BEATS[(value * 6) / 128];
         break;
       }
 
@@ -359,9 +1431,313 @@ void myControlChange(byte channel, byte control, byte value) {
     case CClfomode:
       LFOmodeSelect = value;
       break;
+
+    case CCreverbmix:
+      reverb1.mix(value * DIV127);
+      break;
+
+    case CCreverbsize:
+      reverb1.roomSize(value * DIV127);
+      break;
+
+    case CCreverbdamp:
+      reverb1.damping(value * DIV127);
+      break;
+
+    case CCchorusmix:
+      ensemble1.mix(value * DIV127);
+      break;
+
+    case CCchorusrate:
+      ensemble1.rate(0.1 + (5.0 * (value * DIV127)));
+      break;
+
+    case CCchorusdepth:
+      ensemble1.depth(0.1 + (8.0 * (value * DIV127)));
+      break;
+
+    case CCunison:
+      if (value >= 1 && value <= SYNTH_VOICES) {
+        unisonVoices = value;
+        unisonSet();
+        oscSet();
+      }
+      break;
+
+    case CCunisondetune:
+      unisonDetune = 50 * (value * DIV127);
+      unisonSet();
+      oscSet();
+      break;
+
+    case CCspread:
+      stereoSpread = value * 258;
+      break;
+
+    case CCwidthtrack:
+      widthKeyTrack = value * 258;
+      break;
+
+    case CCseqmode:
+      if (value <= SEQ_MODE_STEP) seqModeSet(value);
+      break;
+
+    case CCarpmode:
+      if (value <= ARP_AS_PLAYED) arp.mode((ArpMode)value);
+      break;
+
+    case CCarpoctaves:
+      arp.octaves(value);
+      break;
+
+    case CCseqgate:
+      AudioNoInterrupts();
+      arp.gate(1 + (99 * value) / 127);
+      stepSeq.gate(1 + (99 * value) / 127);
+      AudioInterrupts();
+      break;
+
+    case CCtempo:
+      seqTempo = 40 + (value * 2);
+      if (clockExternal) break; // steps come from MIDI clock
+      AudioNoInterrupts();
+      arp.tempo(seqTempo, 4);
+      stepSeq.tempo(seqTempo, 4);
+      AudioInterrupts();
+      break;
+
+    case CCseqlength:
+      stepSeq.length(value);
+      break;
+
+    case CCautomation: // clear only on 127, so nothing wipes the lanes on the way past
+      if (value == 127) automation.clear();
+      else automation.mode(value);
+      break;
+
+    case CCautomationbars: // 1 - 32 bars of 4/4
+      if (value < 32) automation.length((value + 1) * 4);
+      break;
+
+    case CCpedal:
+      noteChange(notes.sustain(value >= 64));
+      break;
+
+    case CCpriority: // 0 last, 1 low, 2 high
+      if (value <= PRIORITY_HIGH) notes.priority((NotePriority)value);
+      break;
+
+    case CCglide: // 0 - 2 seconds
+      glide.time(2000 * (value * DIV127) * (value * DIV127));
+      break;
+
+    case CCglidemode: // 0 off, 1 time, 2 rate, 3 time legato only, 4 rate legato only
+      if (value <= 4) {
+        AudioNoInterrupts();
+        glide.mode(value == 0 ? GLIDE_OFF : (GlideMode)(2 - (value & 1)), value >= 3);
+        AudioInterrupts();
+      }
+      break;
+
+    case CClegato:
+      legato = (value >= 64);
+      break;
+
+    case CCclocksync: // >= 64 follows MIDI clock, below runs on CCtempo
+      clockExternal = (value >= 64);
+      if (!clockExternal) {
+        automation.unaligned();
+        AudioNoInterrupts();
+        arp.tempo(seqTempo, 4);
+        stepSeq.tempo(seqTempo, 4);
+        AudioInterrupts();
+      }
+      break;
+
+    case CCseqrecord:
+      AudioNoInterrupts();
+      seqRecord = (value >= 64);
+      if (seqRecord) stepSeq.recordStart();
+      AudioInterrupts();
+      break;
+
+    case CCdrive:
+      limiter1.drive(1.0 + (3.0 * (value * DIV127)));
+      break;
+
+    case CCreverbquality: // 0-14, lines 2/4/8 in steps of 5, diffusers 0-4 within each
+      if (value < 15) {
+        reverbQualityPending = value;
+      }
+      break;
+
+    case CCoscsync: // >= 64 hard syncs osc2 to osc1
+      patch.sync = value >= 64;
+      partApply(part);
+      break;
+
+    case CCringmod: // 0 plain osc2 .. 127 all ring
+      patch.ring = value * DIV127;
+      partApply(part);
+      break;
+
+    case CCfmalgo: // 0 off (subtractive), 1-8 picks the algorithm, see FmBank.h
+      patch.fmAlgorithm = (value == 0 || value > FM_ALGORITHMS) ? FM_OFF : value - 1;
+      partApply(part);
+      break;
+
+    case CCfmoperator: // 0-3, 0 is always a carrier
+      if (value < FM_OPERATORS) fmOperator = value;
+      break;
+
+    case CCfmratio: // quarter steps from 0.5 to 31.75
+      patch.fmRatio[fmOperator] = (value < 2 ? 2 : value) * 0.25;
+      partApply(part);
+      break;
+
+    case CCfmlevel:
+      patch.fmLevel[fmOperator] = value * DIV127;
+      partApply(part);
+      break;
+
+    case CCfmattack:
+      patch.fmAttack[fmOperator] = envelopeTime(value);
+      partApply(part);
+      break;
+
+    case CCfmdecay:
+      patch.fmDecay[fmOperator] = envelopeTime(value);
+      partApply(part);
+      break;
+
+    case CCfmsustain:
+      patch.fmSustain[fmOperator] = value * DIV127;
+      partApply(part);
+      break;
+
+    case CCfmrelease:
+      patch.fmRelease[fmOperator] = envelopeTime(value);
+      partApply(part);
+      break;
+
+    case CCfmfeedback: // operator 3 into itself
+      patch.fmFeedback = value * DIV127;
+      partApply(part);
+      break;
+  }
+}
+
+// Snapshot the current sound
+void presetStore(Preset &preset, const char *name) {
+  memset(&preset, 0, sizeof(preset));
+  memcpy(preset.channelPart, channelPart, sizeof(preset.channelPart));
+  for (byte i = 0; i < PRESET_CONTROL_COUNT; i++) preset.controls[i] = controlValues[presetControls[i]];
+  for (byte p = 0; p < SYNTH_PARTS; p++) presetPartStore(preset.part[p], parts[p]);
+  presetSeal(preset, name);
+}
+
+// Queue a preset, heard two blocks later. A second recall before then
+// simply replaces the first.
+bool presetRecall(const Preset &preset) {
+  if (!presetValid(preset)) return false;
+  AudioNoInterrupts();
+  memcpy(&presetPending, &preset, sizeof(Preset));
+  presetState = PRESET_FADE;
+  AudioInterrupts();
+  return true;
+}
+
+// Audio interrupt. One block fades the voices out on the old sound, the
+// whole preset is swapped in before the next block renders, and that block
+// fades them back in. Effect tails carry on across the change.
+void presetTick(uint32_t blockStart) {
+  if (presetState == PRESET_FADE) {
+    voiceBus.master(0);
+    presetState = PRESET_SWAP;
+  } else if (presetState == PRESET_SWAP) {
+    uint32_t start = cycleCount();
+    presetApply(presetPending);
+    presetCycles = cycleCount() - start;
+    voiceBus.master(1.0);
+    presetState = PRESET_IDLE;
   }
 }
 
+// Presets are the whole synth, so any channel but an MPE member's changes it.
+// One read from flash here in loop(), the swap itself happens in presetTick().
+void myProgramChange(byte channel, byte program) {
+  if (mpeMember(channel)) return;
+  programPending = program;
+  programLoad();
+}
+
+// Also from synthControlLoop(), until no SysEx transfer is writing flash and
+// the SPI bus is free. Only the latest program change waits, one that comes
+// before it is dropped.
+void programLoad() {
+  if (programPending < 0 || sysex.busy() || !spiBus.try_lock()) return;
+  byte program = programPending;
+  programPending = -1;
+  static Preset next;
+  bool loaded = presetBank.load(presetBankSelected, program, next);
+  spiBus.unlock();
+  if (!loaded || !presetRecall(next)) return;
+  config.set(CONFIG_PROGRAM, presetBankSelected * PRESET_BANK_SLOTS + program);
+  configFromPreset(next);
+}
+
+void mySystemExclusive(const uint8_t *data, uint16_t length, bool complete) {
+  sysex.receive(SYSEX_PORT_USB, data, length, complete);
+}
+
+void usbSysexSend(const uint8_t *data, uint16_t length) {
+  usbMIDI.sendSysEx(length, data, true);
+}
+
+void sysexEditStore(Preset &preset) {
+  presetStore(preset, NULL);
+}
+
+// The menu's settings follow a program change, so the menu shows the new
+// sound and bootRestore() rebuilds it the same way
+void configFromPreset(const Preset &preset) {
+  const PresetPart &lead = preset.part[0];
+  const float times[3] = {lead.attack, lead.decay, lead.release};
+  const byte timeKeys[3] = {CONFIG_AMP_ATTACK, CONFIG_AMP_DECAY, CONFIG_AMP_RELEASE};
+  for (byte i = 0; i < 3; i++) {
+    // envelopeTime() backwards
+    int32_t value = times[i] > 1 ? lroundf(log10f(times[i]) * 127 / 4) : 0;
+    config.set(timeKeys[i], value > 127 ? 127 : value);
+  }
+  int32_t sustain = lroundf(lead.sustain * 127);
+  config.set(CONFIG_AMP_SUSTAIN, sustain < 0 ? 0 : sustain > 127 ? 127 : sustain);
+  for (byte i = 0; i < 4; i++) {
+    int32_t value = lroundf(lead.mix[i] / MIXER_HEADROOM * 127);
+    config.set(CONFIG_MIXER_OSC1 + i, value < 0 ? 0 : value > 127 ? 127 : value);
+  }
+}
+
+// Runs in the audio interrupt from presetTick(), or from bootRestore() before any blocks
+void presetApply(const Preset &preset) {
+  for (byte c = 0; c < 16; c++) channelPart[c] = preset.channelPart[c] & (SYNTH_PARTS - 1);
+  for (byte p = 0; p < SYNTH_PARTS; p++) {
+    presetPartLoad(parts[p], preset.part[p]);
+    if (parts[p].budget < 1 || parts[p].budget > SYNTH_VOICES) parts[p].budget = 1;
+    voices.budget(p, parts[p].budget);
+    partApply(p);
+  }
+  for (byte i = 0; i < PRESET_CONTROL_COUNT; i++) {
+    synthControl(0, presetControls[i], preset.controls[i]);
+  }
+
+  // Lead copies of part 0's patch
+  octave2 = parts[0].patch.octave2;
+  detuneFactor = parts[0].patch.detune;
+  osc1Mode = parts[0].patch.wave1;
+  osc2Mode = parts[0].patch.wave2;
+  oscSet();
+}
+
 void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom) {
   static float LFO = 0;
   static unsigned long LFOtime = 0;
@@ -382,14 +1758,14 @@ void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom) {
       if (mode == 0 || mode == 8) {
         LFOpitch = 1;
         oscSet();
-        filter1.frequency(FILfreq);
+        filterFrequency(FILfreq);
       }
       else if (mode >= 1 || mode <= 7) {
         LFOpitch = 1;
         oscSet();
       }
       else if (mode >= 9 || mode <= 13) {
-        filter1.frequency(FILfreq);
+        filterFrequency(FILfreq);
       }
       oldMode = mode;
     }
@@ -404,21 +1780,21 @@ void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom) {
         return;
         break;
       case 1: //Filter FREE
-        filter1.frequency(10000 * ((LFOrange * LFO) + LFOdepth));
+        filterFrequency(10000 * ((LFOrange * LFO) + LFOdepth));
         break;
       case 2: //Filter DOWN
         if (retriggered == true) {
           LFOdirection = true;
           LFO = 1.0;
         }
-        filter1.frequency(10000 * ((LFOrange * LFO) + LFOdepth));
+        filterFrequency(10000 * ((LFOrange * LFO) + LFOdepth));
         break;
       case 3: //Filter UP
         if (retriggered == true) {
           LFOdirection = false;
           LFO = 0;
         }
-        filter1.frequency(10000 * ((LFOrange * LFO) + LFOdepth));
+        filterFrequency(10000 * ((LFOrange * LFO) + LFOdepth));
         break;
       case 4: //Filter 1-DN
         if (retriggered == true) {
@@ -426,7 +1802,7 @@ void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom) {
           LFOdirection = true;
           LFO = 1.0;
         }
-        if (LFOstop == false) filter1.frequency(10000 * ((LFOrange * LFO) + LFOdepth));
+        if (LFOstop == false) filterFrequency(10000 * ((LFOrange * LFO) + LFOdepth));
         break;
       case 5: //Filter 1-UP
         if (retriggered == true) {
@@ -434,7 +1810,7 @@ void LFOupdate(bool retrig, byte mode, float FILtop, float FILbottom) {
           LFOdirection = false;
           LFO = 0;
         }
-        if (LFOstop == false) filter1.frequency(10000 * ((LFOrange * LFO) + LFOdepth));
+        if (LFOstop == false) filterFrequency(10000 * ((LFOrange * LFO) + LFOdepth));
         break;
       case 8: //Pitch OFF
         return;
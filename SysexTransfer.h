@@ -0,0 +1,419 @@
+#ifndef SYSEX_TRANSFER_H__
+#define SYSEX_TRANSFER_H__
+
+#include <Arduino.h>
+#include <TeensyThreads.h>
+#include "Preset.h"
+#include "PresetBank.h"
+
+// Preset and bank dump and load over SysEx, on usbMIDI and the host port.
+//
+// Every message is F0 7D 54 <command> <parameters> F7. A preset travels as
+// SYSEX_CHUNKS data messages of SYSEX_CHUNK bytes each, 7 bit packed (a
+// byte of high bits, then seven bytes of low bits) and followed by the XOR
+// of the packed bytes. Each data message is answered with an ACK or NAK,
+// and the sender waits for it before the next one, so the synth never
+// buffers more than one preset. The ACK for a preset's last chunk only goes
+// out once the preset is in flash. When the synth sends, it waits for the
+// same ACK from the other end, but carries on after SYSEX_ACK_TIMEOUT, so a
+// plain SysEx recorder gets the dump too, just paced.
+//
+// Bytes are unpacked as they arrive, straight into one Preset, so even a
+// message delivered in pieces needs no buffer of its own. Flash is only
+// written by work(), from a background thread; while a write is pending
+// busy() is true and the main loop stays off the flash chip.
+//
+// If the flash chip shares its bus, give bus() the lock that guards it.
+// work() waits for the lock, but a dump read from poll() only tries it and
+// picks up where it left off on a later poll().
+//
+// A bank load that stops before its SYSEX_BANK_END (the sender unplugged or
+// cancelled) is given up after SYSEX_BANK_TIMEOUT, and the bank is left as
+// it was before SYSEX_BANK_BEGIN.
+//
+// Bank SYSEX_EDIT_BANK is the sound playing now: loading it recalls the
+// preset without storing it, and dumping it sends the current settings.
+
+const byte SYSEX_ID = 0x7D;              // non-commercial
+const byte SYSEX_DEVICE = 0x54;          // 'T'
+const byte SYSEX_PRESET_REQUEST = 0x01;  // bank program
+const byte SYSEX_BANK_REQUEST = 0x02;    // bank
+const byte SYSEX_PRESET_DATA = 0x10;     // bank program chunk chunks <packed data> checksum
+const byte SYSEX_BANK_BEGIN = 0x11;      // bank, the presets that follow replace the whole bank
+const byte SYSEX_BANK_END = 0x12;        // bank
+const byte SYSEX_NAK = 0x7E;             // bank program chunk
+const byte SYSEX_ACK = 0x7F;             // bank program chunk
+const byte SYSEX_EDIT_BANK = 0x7F;
+
+const byte SYSEX_PORTS = 2;
+const byte SYSEX_PORT_USB = 0;
+const byte SYSEX_PORT_HOST = 1;
+
+const uint16_t SYSEX_CHUNK = 128;
+const byte SYSEX_CHUNKS = (sizeof(Preset) + SYSEX_CHUNK - 1) / SYSEX_CHUNK;
+const uint16_t SYSEX_HEADER = 8;         // F0 through chunks
+const uint16_t SYSEX_DATA_MAX = SYSEX_HEADER + (SYSEX_CHUNK * 8 + 6) / 7 + 2;
+const uint32_t SYSEX_ACK_TIMEOUT = 200;  // ms
+const uint32_t SYSEX_BANK_TIMEOUT = 5000; // ms without a message before a bank load is given up
+
+typedef void (*SysexSend)(const uint8_t *data, uint16_t length);
+
+// 7 bit packing, a byte at a time
+class Sysex7Decoder {
+  public:
+    void begin(uint8_t *out, uint16_t capacity) {
+      _out = out;
+      _capacity = capacity;
+      _length = 0;
+      _group = 0;
+      _overflow = false;
+    }
+
+    void push(uint8_t value) {
+      if (_group == 0) {
+        _high = value;
+      } else if (_length < _capacity) {
+        _out[_length++] = value | (((_high >> (_group - 1)) & 1) << 7);
+      } else {
+        _overflow = true;
+      }
+      _group = (_group + 1) & 7;
+    }
+
+    uint16_t length() { return _length; }
+    bool overflow() { return _overflow; }
+
+  private:
+    uint8_t *_out;
+    uint16_t _capacity;
+    uint16_t _length;
+    uint8_t _group;
+    uint8_t _high;
+    bool _overflow;
+};
+
+uint16_t sysex7Encode(const uint8_t *in, uint16_t length, uint8_t *out) {
+  uint16_t written = 0;
+  for (uint16_t i = 0; i < length; i += 7) {
+    uint8_t &high = out[written++];
+    high = 0;
+    for (uint8_t j = 0; j < 7 && i + j < length; j++) {
+      high |= (in[i + j] >> 7) << j;
+      out[written++] = in[i + j] & 0x7F;
+    }
+  }
+  return written;
+}
+
+class SysexTransfer {
+  public:
+    void begin(PresetBank &bank, void (*editStore)(Preset &preset), bool (*editLoad)(const Preset &preset));
+    void port(byte port, SysexSend send) { if (port < SYSEX_PORTS) _send[port] = send; }
+    void bus(Threads::Mutex &lock) { _bus = &lock; }
+
+    void receive(byte port, const uint8_t *data, uint16_t length, bool complete);
+    void poll();
+    void work();
+    bool busy() { return _job != JOB_NONE; }
+
+  private:
+    enum Job {
+      JOB_NONE = 0,
+      JOB_SAVE,        // one preset into its slot, the rest of the bank kept
+      JOB_BANK_BEGIN,
+      JOB_BANK_WRITE,
+      JOB_BANK_END,
+      JOB_DONE         // work() has finished, poll() answers
+    };
+
+    void byteIn(uint8_t value);
+    void messageEnd();
+    void presetChunk();
+    void queue(byte job);
+    void reply(byte port, byte command, byte bank, byte program, byte chunk);
+    void sendChunk();
+    void sendNext();
+
+    PresetBank *_bank = NULL;
+    void (*_editStore)(Preset &preset) = NULL;
+    bool (*_editLoad)(const Preset &preset) = NULL;
+    SysexSend _send[SYSEX_PORTS] = {NULL, NULL};
+    Threads::Mutex *_bus = NULL;
+
+    // Receiving, one message at a time from either port
+    Preset _in;
+    Sysex7Decoder _decoder;
+    uint16_t _position = 0;
+    uint8_t _header[SYSEX_HEADER];
+    uint8_t _held = 0;
+    bool _holding = false;
+    uint8_t _checksum = 0;
+    bool _bad = false;
+    byte _port = 0;
+    byte _nextChunk = 0;
+
+    // Flash, handed to work() and answered from poll()
+    volatile byte _job = JOB_NONE;
+    volatile bool _jobOk = false;
+    byte _jobPort = 0;
+    byte _jobBank = 0;
+    byte _jobProgram = 0;
+    byte _jobChunk = 0;
+    uint32_t _bankAt = 0;    // last message of a bank load
+
+    // Sending
+    Preset _out;
+    bool _sending = false;
+    bool _waiting = false;
+    bool _loaded = false;
+    bool _single = false;
+    byte _outPort = 0;
+    byte _outBank = 0;
+    byte _outProgram = 0;
+    byte _outLast = 0;
+    byte _outChunk = 0;
+    uint32_t _sentAt = 0;
+};
+
+void SysexTransfer::begin(PresetBank &bank, void (*editStore)(Preset &preset), bool (*editLoad)(const Preset &preset)) {
+  _bank = &bank;
+  _editStore = editStore;
+  _editLoad = editLoad;
+}
+
+// From a SysEx handler, with the whole message or a piece of it
+void SysexTransfer::receive(byte port, const uint8_t *data, uint16_t length, bool complete) {
+  for (uint16_t i = 0; i < length; i++) {
+    uint8_t value = data[i];
+    if (value == 0xF0) {
+      _position = 0;
+      _holding = false;
+      _bad = false;
+      _port = port;
+      _header[_position++] = value;
+    } else if (value == 0xF7) {
+      complete = true;
+    } else if (_position > 0 && port == _port) {
+      byteIn(value);
+    }
+  }
+  if (complete && _position > 0 && port == _port) {
+    messageEnd();
+    _position = 0;
+  }
+}
+
+void SysexTransfer::byteIn(uint8_t value) {
+  if (_position < SYSEX_HEADER) {
+    _header[_position++] = value;
+    if (_position == 3 && (_header[1] != SYSEX_ID || _header[2] != SYSEX_DEVICE)) _position = 0;
+    else if (_position == SYSEX_HEADER && _header[3] == SYSEX_PRESET_DATA) presetChunk();
+    return;
+  }
+  if (_header[3] != SYSEX_PRESET_DATA || _bad) return;
+  // The last byte is the checksum, so each byte is only unpacked once the next one arrives
+  if (_holding) {
+    _decoder.push(_held);
+    _checksum ^= _held;
+  }
+  _held = value;
+  _holding = true;
+}
+
+// Header of a data message read: check it belongs to this transfer and aim the decoder
+void SysexTransfer::presetChunk() {
+  byte bank = _header[4];
+  byte program = _header[5];
+  byte chunk = _header[6];
+  byte chunks = _header[7];
+  _checksum = 0;
+  if (busy() || chunks != SYSEX_CHUNKS || chunk >= chunks || program >= PRESET_BANK_SLOTS ||
+      (bank >= PRESET_BANKS && bank != SYSEX_EDIT_BANK)) {
+    _bad = true;
+    return;
+  }
+  if (chunk == 0) {
+    _nextChunk = 0;
+    _jobBank = bank;
+    _jobProgram = program;
+  }
+  if (chunk != _nextChunk || bank != _jobBank || program != _jobProgram ||
+      (bank != SYSEX_EDIT_BANK && _bank->writing() >= 0 && _bank->writing() != bank)) {
+    _bad = true;
+    return;
+  }
+  uint16_t offset = chunk * SYSEX_CHUNK;
+  uint16_t size = sizeof(Preset) - offset < SYSEX_CHUNK ? sizeof(Preset) - offset : SYSEX_CHUNK;
+  _decoder.begin((uint8_t *)&_in + offset, size);
+}
+
+void SysexTransfer::messageEnd() {
+  if (_position < 4) return;
+  byte command = _header[3];
+  byte bank = _header[4];
+  byte program = _header[5];
+
+  switch (command) {
+    case SYSEX_PRESET_REQUEST:
+    case SYSEX_BANK_REQUEST:
+      if (_position < (command == SYSEX_PRESET_REQUEST ? 6 : 5)) return;
+      if (bank >= PRESET_BANKS && !(bank == SYSEX_EDIT_BANK && command == SYSEX_PRESET_REQUEST)) return;
+      _sending = true;
+      _waiting = false;
+      _loaded = false;
+      _outPort = _port;
+      _outBank = bank;
+      _outProgram = command == SYSEX_PRESET_REQUEST ? program : 0;
+      _outLast = command == SYSEX_PRESET_REQUEST ? program : PRESET_BANK_SLOTS - 1;
+      _outChunk = 0;
+      _single = command == SYSEX_PRESET_REQUEST;
+      break;
+
+    case SYSEX_PRESET_DATA: {
+      if (_position < SYSEX_HEADER) return;
+      byte chunk = _header[6];
+      uint16_t expected = sizeof(Preset) - chunk * SYSEX_CHUNK;
+      if (expected > SYSEX_CHUNK) expected = SYSEX_CHUNK;
+      if (_bad || !_holding || _held != (_checksum & 0x7F) || _decoder.overflow() || _decoder.length() != expected) {
+        reply(_port, SYSEX_NAK, bank, program, chunk);
+        return;
+      }
+      _nextChunk++;
+      _bankAt = millis();
+      if (_nextChunk < SYSEX_CHUNKS) {
+        reply(_port, SYSEX_ACK, bank, program, chunk);
+      } else if (!presetValid(_in)) {
+        reply(_port, SYSEX_NAK, bank, program, chunk);
+      } else if (bank == SYSEX_EDIT_BANK) {
+        reply(_port, _editLoad && _editLoad(_in) ? SYSEX_ACK : SYSEX_NAK, bank, program, chunk);
+      } else {
+        _jobChunk = chunk;
+        queue(_bank->writing() == bank ? JOB_BANK_WRITE : JOB_SAVE);
+      }
+      break;
+    }
+
+    case SYSEX_BANK_BEGIN:
+    case SYSEX_BANK_END:
+      if (_position < 5) return;
+      if (busy() || bank >= PRESET_BANKS) {
+        reply(_port, SYSEX_NAK, bank, 0, 0);
+        return;
+      }
+      _jobBank = bank;
+      _jobProgram = 0;
+      _jobChunk = 0;
+      queue(command == SYSEX_BANK_BEGIN ? JOB_BANK_BEGIN : JOB_BANK_END);
+      break;
+
+    case SYSEX_ACK:
+    case SYSEX_NAK:
+      if (!_sending || !_waiting || _port != _outPort) return;
+      _waiting = false;
+      if (command == SYSEX_ACK) sendNext();
+      break;
+  }
+}
+
+void SysexTransfer::queue(byte job) {
+  _bankAt = millis();
+  _jobPort = _port;
+  _job = job;
+}
+
+void SysexTransfer::reply(byte port, byte command, byte bank, byte program, byte chunk) {
+  uint8_t message[8] = {0xF0, SYSEX_ID, SYSEX_DEVICE, command, bank, program, chunk, 0xF7};
+  if (_send[port]) _send[port](message, sizeof(message));
+}
+
+// Background thread. Flash writes block, never call this from loop()
+void SysexTransfer::work() {
+  byte job = _job;
+  if (job == JOB_NONE || job == JOB_DONE) return;
+  bool ok = false;
+  if (_bus) _bus->lock();
+  switch (job) {
+    case JOB_SAVE:       ok = _bank->save(_jobBank, _jobProgram, _in); break;
+    case JOB_BANK_BEGIN: ok = _bank->writeBegin(_jobBank); break;
+    case JOB_BANK_WRITE: ok = _bank->write(_jobProgram, _in); break;
+    case JOB_BANK_END:   ok = _bank->writing() == _jobBank && _bank->writeEnd(); break;
+  }
+  if (_bus) _bus->unlock();
+  _jobOk = ok;
+  _job = JOB_DONE;
+}
+
+// From loop(): answers finished flash writes and sends the next chunk of a dump
+void SysexTransfer::poll() {
+  if (_job == JOB_DONE) {
+    reply(_jobPort, _jobOk ? SYSEX_ACK : SYSEX_NAK, _jobBank, _jobProgram, _jobChunk);
+    _bankAt = millis();
+    _job = JOB_NONE;
+  }
+  // work() only touches the bank while a job is pending, so it is safe to drop here
+  if (!busy() && _bank && _bank->writing() >= 0 && millis() - _bankAt >= SYSEX_BANK_TIMEOUT) {
+    _bank->writeAbort();
+  }
+  if (!_sending || busy()) return;
+  if (_waiting) {
+    if (millis() - _sentAt < SYSEX_ACK_TIMEOUT) return;
+    _waiting = false;
+    sendNext();
+    if (!_sending) return;
+  }
+  sendChunk();
+}
+
+// Past the chunk just sent, to the next chunk or the next stored preset
+void SysexTransfer::sendNext() {
+  if (++_outChunk < SYSEX_CHUNKS) return;
+  _outChunk = 0;
+  _loaded = false;
+  if (_outProgram >= _outLast) _sending = false;
+  else _outProgram++;
+}
+
+void SysexTransfer::sendChunk() {
+  if (!_loaded) {
+    if (_outBank == SYSEX_EDIT_BANK) {
+      if (_editStore) _editStore(_out);
+      _loaded = _editStore != NULL;
+    } else {
+      if (_bus && !_bus->try_lock()) return;
+      _loaded = _bank->load(_outBank, _outProgram, _out);
+      if (_bus) _bus->unlock();
+    }
+    if (!_loaded) {
+      // Nothing stored there: a single request is refused, a bank dump moves on
+      if (_single) reply(_outPort, SYSEX_NAK, _outBank, _outProgram, 0);
+      _outChunk = SYSEX_CHUNKS - 1;
+      sendNext();
+      return;
+    }
+  }
+
+  static uint8_t message[SYSEX_DATA_MAX];
+  uint16_t offset = _outChunk * SYSEX_CHUNK;
+  uint16_t size = sizeof(Preset) - offset < SYSEX_CHUNK ? sizeof(Preset) - offset : SYSEX_CHUNK;
+  uint16_t length = 0;
+  message[length++] = 0xF0;
+  message[length++] = SYSEX_ID;
+  message[length++] = SYSEX_DEVICE;
+  message[length++] = SYSEX_PRESET_DATA;
+  message[length++] = _outBank;
+  message[length++] = _outProgram;
+  message[length++] = _outChunk;
+  message[length++] = SYSEX_CHUNKS;
+  uint16_t packed = sysex7Encode((const uint8_t *)&_out + offset, size, message + length);
+  uint8_t checksum = 0;
+  for (uint16_t i = 0; i < packed; i++) checksum ^= message[length + i];
+  length += packed;
+  message[length++] = checksum & 0x7F;
+  message[length++] = 0xF7;
+
+  if (_send[_outPort]) _send[_outPort](message, length);
+  _sentAt = millis();
+  _waiting = true;
+}
+
+#endif
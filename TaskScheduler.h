@@ -0,0 +1,162 @@
+#ifndef TASK_SCHEDULER_H__
+#define TASK_SCHEDULER_H__
+
+#include <Arduino.h>
+
+// Cooperative scheduler for loop().
+//
+// Each task has a priority, a period, a deadline and a budget, all in
+// microseconds. A task is due once its period has passed since its last
+// release, and it misses its deadline if it starts more than deadline after
+// that. run() starts at most one task per call: the most urgent one that is
+// due and whose budget fits before the deadline of every more urgent task.
+// A long task such as a display frame is therefore only started right after
+// MIDI has been drained and only if it can finish before MIDI is needed
+// again; otherwise it is deferred, and the deferral is counted.
+//
+// Nothing is preempted, so a task that runs past its budget delays what is
+// behind it once. That is counted as an overrun, and until it runs within
+// budget again the fit is checked against its last run time instead, so a
+// frame that turned out slow is not started again where it doesn't fit. The
+// per-task stats (runs, average and worst run time, worst lateness) show
+// which budget to raise or which task to split.
+//
+// Periods are kept on a fixed grid so a slow pass doesn't drift the rate,
+// but a task more than a whole period behind drops the backlog instead of
+// running back to back to catch up.
+
+const byte SCHEDULER_TASKS = 8;
+
+enum TaskPriority {TASK_MIDI, TASK_ENCODER, TASK_CONTROL, TASK_UI, TASK_DISPLAY};
+
+typedef void (*TaskFunction)();
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t misses;      // started more than deadline after being due
+  uint32_t overruns;    // ran longer than budget
+  uint32_t deferrals;   // due but held back for a more urgent task
+  uint32_t timeTotal;   // us
+  uint32_t timeMax;
+  uint32_t lateMax;
+};
+
+class TaskScheduler {
+  public:
+    bool add(const char *name, TaskFunction function, byte priority, uint32_t period, uint32_t deadline, uint32_t budget);
+    void run();
+
+    const TaskStats &stats(byte task) { return _tasks[task % SCHEDULER_TASKS].stats; }
+    byte tasks() { return _count; }
+    void resetStats();
+    void report(Print &out);
+
+  private:
+    struct Task {
+      const char *name;
+      TaskFunction function;
+      byte priority;
+      bool deferred;
+      uint32_t period;
+      uint32_t deadline;
+      uint32_t budget;
+      uint32_t cost;     // budget, or the last run time if that was longer
+      uint32_t due;
+      TaskStats stats;
+    };
+
+    void execute(Task &task, uint32_t now);
+
+    Task _tasks[SCHEDULER_TASKS];
+    byte _count = 0;
+    uint32_t _busy = 0;
+    uint32_t _since = 0;
+};
+
+// Tasks are kept sorted by priority, so run() can scan them in order
+bool TaskScheduler::add(const char *name, TaskFunction function, byte priority, uint32_t period, uint32_t deadline, uint32_t budget) {
+  if (_count >= SCHEDULER_TASKS || !function) return false;
+  byte slot = _count++;
+  while (slot > 0 && _tasks[slot - 1].priority > priority) {
+    _tasks[slot] = _tasks[slot - 1];
+    slot--;
+  }
+  Task &task = _tasks[slot];
+  task.name = name;
+  task.function = function;
+  task.priority = priority;
+  task.deferred = false;
+  task.period = period;
+  task.deadline = deadline;
+  task.budget = budget;
+  task.cost = budget;
+  task.due = micros();
+  memset(&task.stats, 0, sizeof(task.stats));
+  if (_count == 1) _since = task.due;
+  return true;
+}
+
+// Call from loop() and nothing else
+void TaskScheduler::run() {
+  uint32_t now = micros();
+  for (byte i = 0; i < _count; i++) {
+    Task &task = _tasks[i];
+    if ((int32_t)(now - task.due) < 0) continue;
+
+    // Every more urgent task is not due yet, or it would have run
+    bool fits = true;
+    for (byte j = 0; j < i && fits; j++) {
+      if (_tasks[j].priority == task.priority) continue;
+      int32_t slack = (int32_t)(_tasks[j].due + _tasks[j].deadline - now);
+      fits = slack >= (int32_t)task.cost;
+    }
+    if (!fits) {
+      if (!task.deferred) task.stats.deferrals++;
+      task.deferred = true;
+      continue;
+    }
+    execute(task, now);
+    return;
+  }
+}
+
+void TaskScheduler::execute(Task &task, uint32_t now) {
+  uint32_t late = now - task.due;
+  if (late > task.deadline) task.stats.misses++;
+  if (late > task.stats.lateMax) task.stats.lateMax = late;
+  task.deferred = false;
+
+  uint32_t start = micros();
+  task.function();
+  uint32_t end = micros();
+  uint32_t took = end - start;
+
+  task.stats.runs++;
+  task.stats.timeTotal += took;
+  if (took > task.stats.timeMax) task.stats.timeMax = took;
+  if (took > task.budget) task.stats.overruns++;
+  task.cost = max(took, task.budget);
+  _busy += took;
+
+  task.due += task.period;
+  if ((int32_t)(end - task.due) > (int32_t)task.period) task.due = end;
+}
+
+void TaskScheduler::resetStats() {
+  for (byte i = 0; i < _count; i++) memset(&_tasks[i].stats, 0, sizeof(TaskStats));
+  _busy = 0;
+  _since = micros();
+}
+
+void TaskScheduler::report(Print &out) {
+  out.printf("task       runs  avg us  max us  late us  miss  over  defer\n");
+  for (byte i = 0; i < _count; i++) {
+    const TaskStats &s = _tasks[i].stats;
+    out.printf("%-8s %6lu  %6lu  %6lu  %7lu  %4lu  %4lu  %5lu\n", _tasks[i].name, s.runs,
+               s.runs ? s.timeTotal / s.runs : 0, s.timeMax, s.lateMax, s.misses, s.overruns, s.deferrals);
+  }
+  uint32_t elapsed = micros() - _since;
+  out.printf("load %lu%%\n", elapsed ? (uint32_t)((uint64_t)_busy * 100 / elapsed) : 0);
+}
+
+#endif
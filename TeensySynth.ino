@@ -1,26 +1,91 @@
-
-
 //#include "DisplayManager.h"
 #include "SynthLib.h"
 #include "Menu.h"
 #include <TeensyThreads.h>
 //#include "DisplayLib.h"
 #include "UsbMidiHost.h"
+#include "TaskScheduler.h"
+
+//DisplayManager displayManager = DisplayManager(touch);
+
+// DisplayLib.h and DisplayManager.h were wired without the flash chip and
+// put the TFT's D/C on its chip select, pin 6. Move D/C and change TFT_DC
+// there before including either.
+#ifdef TFT_DC
+static_assert(TFT_DC != FLASH_CHIP_SELECT, "TFT_DC is the flash chip select");
+#endif
+
+// The menu threads get the shortest slice, so a turn of theirs never holds
+// loop() away from MIDI for long
+const int MENU_TIME_SLICE = 1;               // TeensyThreads ticks
+
+TaskScheduler scheduler;
+
+void midiTask() {
+  ProfileScope scope(profiler, PROFILE_MIDI);
+  usbMidiHostLoop();
+  synthMidiLoop();
+}
+
+// Hand the rest of the slice to the menu and config threads
+void uiTask() {
+  threads.yield();
+}
+
+#ifdef DISPLAY_LIB_H__
+// Skips the frame while the menu or a flash write has the SPI bus
+void displayTask() {
+  if (!spiBus.try_lock()) return;
+  ProfileScope scope(profiler, PROFILE_DISPLAY);
+  displayLoop();
+  spiBus.unlock();
+}
+#endif
 
-//DisplayManager displayManager = DisplayManager();
+// Send 'p' over Serial for the boot timings and the profile histograms, or
+// 's' for the scheduler's task stats and the menu thread's load. Each set of
+// numbers then starts again. Nothing is printed unasked: setup() is over
+// before USB serial has enumerated, and the port is shared with SysEx.
+void serialTask() {
+  while (Serial.available()) {
+    char command = Serial.read();
+    if (command == 'p') {
+      bootReport(Serial);
+      profiler.report(Serial);
+      profiler.reset();
+    } else if (command == 's') {
+      scheduler.report(Serial);
+      menuReport(Serial);
+      scheduler.resetStats();
+    }
+  }
+}
 
 void setup ()
 {
   synthSetup();
-  //displaySetup();
   menuSetup();
-  threads.addThread(menuLoop);
+  threads.setTimeSlice(threads.addThread(menuLoop), MENU_TIME_SLICE);
+  threads.setTimeSlice(threads.addThread(configLoop), MENU_TIME_SLICE);
+  bootMark(BOOT_MENU);
   usbMidiHostSetup();
+  bootMark(BOOT_USB_HOST);
+
+  //                                            period  deadline  budget (us)
+  scheduler.add("midi", midiTask, TASK_MIDI, 250, 2000, 200);
+  scheduler.add("encoder", handleMainEncoder, TASK_ENCODER, 2000, 10000, 100);
+  scheduler.add("control", synthControlLoop, TASK_CONTROL, 500, 2000, 300);
+  scheduler.add("ui", uiTask, TASK_UI, 5000, 20000, 1500);
+  scheduler.add("serial", serialTask, TASK_UI, 100000, 100000, 500);
+#ifdef DISPLAY_LIB_H__
+  // Shares the TFT with the menu, so only one of them should be drawing
+  displaySetup();
+  scheduler.add("display", displayTask, TASK_DISPLAY, 33000, 100000, 1500);
+#endif
 }
 
 void loop ()
 {
-  handleMainEncoder();
-  usbMidiHostLoop();
-  synthLoop();
+  profiler.mark(PROFILE_LOOP);
+  scheduler.run();
 }
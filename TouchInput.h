@@ -0,0 +1,145 @@
+#ifndef TOUCH_INPUT_H__
+#define TOUCH_INPUT_H__
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_FT6206.h>
+
+// Touch input from the FT6206 capacitive controller, driven by its INT line.
+//
+// The controller pulls INT low when it has a touch to report. The interrupt
+// only notes the time and sets a flag; the I2C reads happen in service(),
+// called from the thread that wants the events, and only after an interrupt
+// or while a finger is down. A finger that is down is read every
+// TOUCH_POLL_INTERVAL, so moves and the release are seen even when the
+// controller doesn't pulse INT for them.
+//
+// service() turns the reads into down, move and up events in screen
+// coordinates, each stamped with micros(), and queues them for read(). A
+// down event carries the time of the interrupt, so its timestamp doesn't
+// depend on how often service() runs. A release only counts after
+// TOUCH_RELEASE_READS empty reads in a row, so a finger at the threshold
+// gives one down and one up instead of a burst, and moves smaller than
+// TOUCH_MOVE_THRESHOLD are dropped.
+//
+// The queue has one writer and one reader, each moving only its own index,
+// so it needs no lock. When it is full new events are dropped and counted.
+
+const byte TOUCH_IRQ_PIN = 3;               // FT6206 INT
+const byte TOUCH_QUEUE_SIZE = 16;           // power of two
+const uint32_t TOUCH_POLL_INTERVAL = 10;    // ms between reads while a finger is down
+const byte TOUCH_RELEASE_READS = 2;
+const int16_t TOUCH_MOVE_THRESHOLD = 3;     // pixels
+const int16_t TOUCH_WIDTH = 320;            // landscape, as the screen is mounted
+const int16_t TOUCH_HEIGHT = 240;
+
+enum TouchEventType {TOUCH_DOWN, TOUCH_MOVE, TOUCH_UP};
+
+struct TouchEvent {
+  byte type;
+  int16_t x;
+  int16_t y;
+  uint32_t time;   // micros()
+};
+
+class TouchInput {
+  public:
+    bool begin(byte irqPin = TOUCH_IRQ_PIN, byte threshold = 40);
+    void service();
+    bool read(TouchEvent &event);
+
+    bool pending() { return _pending || (_touching && millis() - _readAt >= TOUCH_POLL_INTERVAL); }
+    bool touching() { return _touching; }
+    uint32_t reads() { return _reads; }
+    uint32_t dropped() { return _dropped; }
+
+  private:
+    static void interrupt();
+    void push(byte type, int16_t x, int16_t y, uint32_t time);
+
+    static TouchInput *_active;
+    Adafruit_FT6206 _ts;
+    TouchEvent _queue[TOUCH_QUEUE_SIZE];
+    volatile byte _head = 0;
+    volatile byte _tail = 0;
+    volatile bool _pending = false;
+    volatile uint32_t _irqAt = 0;
+    bool _touching = false;
+    byte _emptyReads = 0;
+    int16_t _x = 0;
+    int16_t _y = 0;
+    uint32_t _readAt = 0;
+    uint32_t _reads = 0;
+    uint32_t _dropped = 0;
+};
+
+TouchInput *TouchInput::_active = NULL;
+
+bool TouchInput::begin(byte irqPin, byte threshold) {
+  if (!_ts.begin(threshold)) return false;
+  _active = this;
+  pinMode(irqPin, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(irqPin), interrupt, FALLING);
+  return true;
+}
+
+void TouchInput::interrupt() {
+  if (!_active->_pending) _active->_irqAt = micros();
+  _active->_pending = true;
+}
+
+void TouchInput::service() {
+  if (!pending()) return;
+  __disable_irq();
+  bool irq = _pending;
+  uint32_t irqAt = _irqAt;
+  _pending = false;
+  __enable_irq();
+  _readAt = millis();
+  _reads++;
+
+  if (_ts.touched()) {
+    // The panel reports portrait coordinates
+    TS_Point p = _ts.getPoint();
+    int16_t x = constrain(TOUCH_WIDTH - p.y, 0, TOUCH_WIDTH - 1);
+    int16_t y = constrain((int)p.x, 0, TOUCH_HEIGHT - 1);
+    _emptyReads = 0;
+    if (!_touching) {
+      _touching = true;
+      _x = x;
+      _y = y;
+      push(TOUCH_DOWN, x, y, irq ? irqAt : micros());
+    } else if (abs(x - _x) >= TOUCH_MOVE_THRESHOLD || abs(y - _y) >= TOUCH_MOVE_THRESHOLD) {
+      _x = x;
+      _y = y;
+      push(TOUCH_MOVE, x, y, micros());
+    }
+  } else if (_touching && ++_emptyReads >= TOUCH_RELEASE_READS) {
+    _touching = false;
+    _emptyReads = 0;
+    push(TOUCH_UP, _x, _y, micros());
+  }
+}
+
+void TouchInput::push(byte type, int16_t x, int16_t y, uint32_t time) {
+  byte next = (_head + 1) & (TOUCH_QUEUE_SIZE - 1);
+  if (next == _tail) {
+    _dropped++;
+    return;
+  }
+  TouchEvent &event = _queue[_head];
+  event.type = type;
+  event.x = x;
+  event.y = y;
+  event.time = time;
+  _head = next;
+}
+
+bool TouchInput::read(TouchEvent &event) {
+  if (_tail == _head) return false;
+  event = _queue[_tail];
+  _tail = (_tail + 1) & (TOUCH_QUEUE_SIZE - 1);
+  return true;
+}
+
+#endif
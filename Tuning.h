@@ -0,0 +1,191 @@
+#ifndef TUNING_H__
+#define TUNING_H__
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdlib.h>
+
+// Scala scale (.scl) and keyboard mapping (.kbm) support.
+//
+// The parser works on text already read into memory and fills a 128 entry
+// table with the pitch of every MIDI key in cents above MIDI note 0, the
+// same unit the glide and MPE code use. All the float work happens here,
+// off the audio path; playing a note is one table read. Keys the mapping
+// leaves out are TUNING_UNMAPPED and do not sound.
+//
+// Without a .kbm the scale is mapped linearly with its first degree on
+// middle C and A above it at 440 Hz, as Scala itself does.
+
+const byte TUNING_MAX_DEGREES = 128;
+const int32_t TUNING_UNMAPPED = -0x7FFFFFFF;
+const float TUNING_BASE_HZ = 8.1757989; // MIDI note 0, see Glide.h
+
+class Tuning {
+  public:
+    Tuning() { equal(); }
+
+    void equal();
+    bool scale(const char *scl);
+    bool keyboard(const char *kbm);
+    void build(int32_t *table);
+
+  private:
+    static const char *nextLine(const char *text, char *line, byte size);
+    float degreeCents(int32_t degree);
+    bool keyCents(int key, float &cents);
+
+    float _cents[TUNING_MAX_DEGREES];   // degree 1..n, the last one is the period
+    byte _degrees;
+
+    byte _mapSize;
+    byte _firstKey;
+    byte _lastKey;
+    byte _middleKey;
+    byte _referenceKey;
+    float _referenceHz;
+    byte _octaveDegree;
+    int16_t _map[128];                  // -1 for an unmapped slot
+};
+
+// Twelve tone equal temperament and the default keyboard
+void Tuning::equal() {
+  _degrees = 12;
+  for (byte i = 0; i < 12; i++) _cents[i] = (i + 1) * 100.0f;
+  _mapSize = 0;
+  _firstKey = 0;
+  _lastKey = 127;
+  _middleKey = 60;
+  _referenceKey = 69;
+  _referenceHz = 440.0f;
+  _octaveDegree = 12;
+}
+
+// Copy the next line that is not a comment, NULL at the end of the text
+const char *Tuning::nextLine(const char *text, char *line, byte size) {
+  while (text && *text) {
+    const char *end = text;
+    while (*end && *end != '\n') end++;
+    bool comment = (*text == '!');
+    if (!comment) {
+      byte n = 0;
+      for (const char *c = text; c < end && n < size - 1; c++) {
+        if (*c != '\r') line[n++] = *c;
+      }
+      line[n] = 0;
+    }
+    text = *end ? end + 1 : end;
+    if (!comment) return text;
+  }
+  return NULL;
+}
+
+bool Tuning::scale(const char *scl) {
+  char line[80];
+  const char *text = nextLine(scl, line, sizeof(line)); // description
+  if (!text) return false;
+  text = nextLine(text, line, sizeof(line));
+  if (!text) return false;
+  int count = atoi(line);
+  if (count < 1 || count > TUNING_MAX_DEGREES) return false;
+
+  for (int i = 0; i < count; i++) {
+    text = nextLine(text, line, sizeof(line));
+    if (!text) return false;
+    char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    float cents;
+    if (strchr(p, '.')) {
+      cents = strtod(p, NULL);
+    } else {
+      // Ratio, a/b or a whole number
+      char *slash;
+      long num = strtol(p, &slash, 10);
+      long den = (*slash == '/') ? strtol(slash + 1, NULL, 10) : 1;
+      if (num <= 0 || den <= 0) return false;
+      cents = 1200.0f * log2f((float)num / den);
+    }
+    _cents[i] = cents;
+  }
+  _degrees = count;
+  if (_mapSize == 0) _octaveDegree = count;
+  return true;
+}
+
+bool Tuning::keyboard(const char *kbm) {
+  char line[80];
+  int value[7];
+  float referenceHz = 0;
+  const char *text = kbm;
+  for (byte i = 0; i < 7; i++) {
+    text = nextLine(text, line, sizeof(line));
+    if (!text) return false;
+    if (i == 5) referenceHz = strtod(line, NULL);
+    else value[i] = atoi(line);
+  }
+  if (value[0] < 0 || value[0] > 127 || referenceHz <= 0) return false;
+
+  for (int i = 0; i < value[0]; i++) {
+    text = nextLine(text, line, sizeof(line));
+    // Missing trailing entries are unmapped, as in Scala
+    if (!text || line[0] == 'x' || line[0] == 'X') _map[i] = -1;
+    else _map[i] = atoi(line);
+  }
+
+  _mapSize = value[0];
+  _firstKey = constrain(value[1], 0, 127);
+  _lastKey = constrain(value[2], 0, 127);
+  _middleKey = constrain(value[3], 0, 127);
+  _referenceKey = constrain(value[4], 0, 127);
+  _referenceHz = referenceHz;
+  _octaveDegree = value[6];
+  if (_mapSize == 0 || _octaveDegree == 0) _octaveDegree = _degrees;
+  return true;
+}
+
+// Cents of a scale degree above degree 0, any number of periods up or down
+float Tuning::degreeCents(int32_t degree) {
+  int32_t period = degree / _degrees;
+  int32_t step = degree % _degrees;
+  if (step < 0) {
+    step += _degrees;
+    period--;
+  }
+  float cents = period * _cents[_degrees - 1];
+  if (step > 0) cents += _cents[step - 1];
+  return cents;
+}
+
+// Cents of a key above the middle key, false if it is unmapped
+bool Tuning::keyCents(int key, float &cents) {
+  if (key < _firstKey || key > _lastKey) return false;
+  int offset = key - _middleKey;
+  int32_t degree = offset;
+  if (_mapSize) {
+    int repeat = offset / _mapSize;
+    int slot = offset % _mapSize;
+    if (slot < 0) {
+      slot += _mapSize;
+      repeat--;
+    }
+    if (_map[slot] < 0) return false;
+    degree = _map[slot] + repeat * _octaveDegree;
+  }
+  cents = degreeCents(degree);
+  return true;
+}
+
+void Tuning::build(int32_t *table) {
+  // Anchor the reference key to its frequency. If the mapping skips it, its
+  // pitch is still where it would be with a linear map.
+  float referenceCents;
+  if (!keyCents(_referenceKey, referenceCents)) referenceCents = degreeCents(_referenceKey - _middleKey);
+  float offset = 1200.0f * log2f(_referenceHz / TUNING_BASE_HZ) - referenceCents;
+
+  for (int key = 0; key < 128; key++) {
+    float cents;
+    if (keyCents(key, cents)) table[key] = lroundf(cents + offset);
+    else table[key] = TUNING_UNMAPPED;
+  }
+}
+
+#endif
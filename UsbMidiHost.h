@@ -25,10 +25,64 @@ void OnControlChange(byte channel, byte control, byte value)
   myControlChange(channel, control, value);
 }
 
+void OnPitchChange(byte channel, int pitch)
+{
+  myPitchBend(channel, pitch);
+}
+
+void OnAfterTouch(byte channel, byte pressure)
+{
+  myAfterTouch(channel, pressure);
+}
+
+void OnProgramChange(byte channel, byte program)
+{
+  myProgramChange(channel, program);
+}
+
+void OnSystemExclusive(const uint8_t *data, uint16_t length, bool complete)
+{
+  sysex.receive(SYSEX_PORT_HOST, data, length, complete);
+}
+
+void hostSysexSend(const uint8_t *data, uint16_t length)
+{
+  midi1.sendSysEx(length, data, true);
+}
+
+void OnClock()
+{
+  myClock();
+}
+
+void OnStart()
+{
+  myStart();
+}
+
+void OnContinue()
+{
+  myContinue();
+}
+
+void OnStop()
+{
+  myStop();
+}
+
 void usbMidiHostSetup()
 {
   myusb.begin();
   midi1.setHandleNoteOff(OnNoteOff);
   midi1.setHandleNoteOn(OnNoteOn);
   midi1.setHandleControlChange(OnControlChange);
+  midi1.setHandlePitchChange(OnPitchChange);
+  midi1.setHandleAfterTouchChannel(OnAfterTouch);
+  midi1.setHandleClock(OnClock);
+  midi1.setHandleStart(OnStart);
+  midi1.setHandleContinue(OnContinue);
+  midi1.setHandleStop(OnStop);
+  midi1.setHandleProgramChange(OnProgramChange);
+  midi1.setHandleSystemExclusive(OnSystemExclusive);
+  sysex.port(SYSEX_PORT_HOST, hostSysexSend);
 }